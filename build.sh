@@ -1,2 +1,23 @@
 #!/bin/sh
-gcc source/main.c -o tapewave -std=c11 -Wall
+set -e
+
+CFLAGS="-std=c11 -Wall -O2"
+LIB_SOURCES="source/tapewave.c source/tape.c source/wave_table.c source/decode.c source/pulse.c source/pulse_list.c source/flac.c source/tzx.c source/turbo.c"
+
+# libtapewave, as both a static and a shared library
+mkdir -p build
+LIB_OBJECTS=""
+for source in ${LIB_SOURCES}
+do
+    object="build/$(basename "${source}" .c).o"
+    gcc -c "${source}" -o "${object}" ${CFLAGS} -fPIC
+    LIB_OBJECTS="${LIB_OBJECTS} ${object}"
+done
+ar rcs libtapewave.a ${LIB_OBJECTS}
+gcc -shared ${LIB_OBJECTS} -o libtapewave.so -Wl,-soname,libtapewave.so -pthread
+
+# Command-line tool
+gcc source/main.c source/cache.c source/pack.c libtapewave.a -o tapewave ${CFLAGS} -pthread
+
+# Encoder benchmark
+gcc source/bench.c libtapewave.a -o tapewave-bench ${CFLAGS} -pthread
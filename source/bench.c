@@ -0,0 +1,347 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * Encoder benchmark. Renders synthetic programs through each output path,
+ * reporting one JSON object per line.
+ *
+ * JoppyFurr 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "tapewave.h"
+
+/* Each case is repeated until it has run for at least this long. */
+#define BENCH_DEFAULT_SECONDS   1.0
+
+typedef enum output_path_e {
+    OUTPUT_FILE,    /* Whole file rendered into one buffer, written with one call */
+    OUTPUT_BUFFER,  /* Rendered directly into caller-supplied memory */
+    OUTPUT_PIPE,    /* Streamed down a pipe in spans, drained by another thread */
+    OUTPUT_MMAP,    /* Rendered directly into a memory-mapping of the output file */
+    OUTPUT_PULSES,  /* Described as a list of pulses, then lowered into caller-supplied memory */
+    OUTPUT_COUNT
+} output_path_t;
+
+static const char *output_path_names [OUTPUT_COUNT] = { "file", "buffer", "pipe", "mmap", "pulses" };
+
+
+/*
+ * Get the current time in seconds.
+ */
+static double now (void)
+{
+    struct timespec time;
+    clock_gettime (CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+/*
+ * Get the number of write syscalls made by the calling thread so far,
+ * or -1 if the kernel does not provide I/O accounting.
+ */
+static long write_syscalls (void)
+{
+    long syscw = -1;
+    char line [64];
+
+    FILE *io = fopen ("/proc/thread-self/io", "r");
+    if (io == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets (line, sizeof (line), io) != NULL)
+    {
+        if (sscanf (line, "syscw: %ld", &syscw) == 1)
+        {
+            break;
+        }
+    }
+
+    fclose (io);
+
+    return syscw;
+}
+
+
+/*
+ * Drain the read end of a pipe until it is closed.
+ */
+static void *pipe_drain (void *arg)
+{
+    int fd = *(int *) arg;
+    uint8_t buffer [65536];
+
+    while (true)
+    {
+        ssize_t result = read (fd, buffer, sizeof (buffer));
+
+        if (result == 0 || (result < 0 && errno != EINTR))
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Fill a program with reproducible pseudo-random bytes.
+ */
+static void synthetic_program (uint8_t *program, uint32_t length)
+{
+    uint32_t state = 0x5c3000;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        state = state * 1103515245 + 12345;
+        program [i] = state >> 16;
+    }
+}
+
+
+/*
+ * Render a tape's samples by way of its pulse list. The wave header is left unwritten.
+ */
+static int encode_pulses (const tapewave_options_t *options, const uint8_t *program, uint16_t program_length,
+                          uint8_t *buffer)
+{
+    tapewave_tape_t *tape = tapewave_tape_create (options, "BENCHMARK", program, program_length);
+    if (tape == NULL)
+    {
+        return -1;
+    }
+
+    size_t pulse_count;
+    tapewave_pulse_t *pulses = tapewave_tape_pulses (tape, &pulse_count);
+    if (pulses == NULL)
+    {
+        tapewave_tape_free (tape);
+        return -1;
+    }
+
+    tapewave_render_pulses (pulses, pulse_count, buffer + TAPEWAVE_WAV_HEADER_SIZE);
+
+    free (pulses);
+    tapewave_tape_free (tape);
+
+    return 0;
+}
+
+
+/*
+ * Run one benchmark case, printing its results.
+ */
+static bool bench_case (tapewave_encoder_t *encoder, const tapewave_options_t *options, const uint8_t *program,
+                        uint16_t program_length, output_path_t path, double min_seconds)
+{
+    uint32_t wav_size = tapewave_wav_size (options, program_length);
+    uint8_t *buffer = NULL;
+    char temp_filename [] = "/tmp/tapewave-bench-XXXXXX";
+    int fd = -1;
+    int pipe_fds [2] = { -1, -1 };
+    pthread_t drain_thread;
+
+    switch (path)
+    {
+        case OUTPUT_FILE:
+        case OUTPUT_MMAP:
+            fd = mkstemp (temp_filename);
+            if (fd < 0)
+            {
+                fprintf (stderr, "Failed to create temporary file.\n");
+                return false;
+            }
+            unlink (temp_filename);
+            break;
+
+        case OUTPUT_BUFFER:
+        case OUTPUT_PULSES:
+            buffer = malloc (wav_size);
+            if (buffer == NULL)
+            {
+                fprintf (stderr, "Failed to allocate output buffer.\n");
+                return false;
+            }
+            break;
+
+        case OUTPUT_PIPE:
+            if (pipe (pipe_fds) < 0 || pthread_create (&drain_thread, NULL, pipe_drain, &pipe_fds [0]) != 0)
+            {
+                fprintf (stderr, "Failed to create pipe.\n");
+                return false;
+            }
+            fd = pipe_fds [1];
+            break;
+
+        default:
+            return false;
+    }
+
+    uint32_t iterations = 0;
+    long syscalls_start = write_syscalls ();
+    double start_time = now ();
+    double elapsed = 0;
+    int result = 0;
+
+    while (elapsed < min_seconds && result == 0)
+    {
+        switch (path)
+        {
+            case OUTPUT_FILE:
+                if (ftruncate (fd, 0) < 0 || lseek (fd, 0, SEEK_SET) < 0)
+                {
+                    result = -1;
+                    break;
+                }
+                result = tapewave_encode (encoder, options, "BENCHMARK", program, program_length, fd, false);
+                break;
+
+            case OUTPUT_BUFFER:
+                result = tapewave_encode_to_buffer (options, "BENCHMARK", program, program_length, buffer, wav_size);
+                break;
+
+            case OUTPUT_PIPE:
+                result = tapewave_encode (encoder, options, "BENCHMARK", program, program_length, fd, true);
+                break;
+
+            case OUTPUT_MMAP:
+                result = tapewave_encode_to_mmap (options, "BENCHMARK", program, program_length, fd);
+                break;
+
+            case OUTPUT_PULSES:
+                result = encode_pulses (options, program, program_length, buffer);
+                break;
+
+            default:
+                break;
+        }
+
+        iterations++;
+        elapsed = now () - start_time;
+    }
+
+    long syscalls_end = write_syscalls ();
+
+    if (path == OUTPUT_PIPE)
+    {
+        close (pipe_fds [1]);
+        pthread_join (drain_thread, NULL);
+        close (pipe_fds [0]);
+    }
+    else if (path == OUTPUT_FILE || path == OUTPUT_MMAP)
+    {
+        close (fd);
+    }
+    free (buffer);
+
+    if (result < 0)
+    {
+        fprintf (stderr, "Benchmark failed: %s.\n", strerror (errno));
+        return false;
+    }
+
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+
+    double samples = (double) (wav_size - TAPEWAVE_WAV_HEADER_SIZE) * iterations;
+    double bytes = (double) wav_size * iterations;
+
+    printf ("{\"program_bytes\": %u, \"sample_rate\": %u, \"output\": \"%s\", \"iterations\": %u, "
+            "\"seconds\": %.6f, \"samples_per_second\": %.0f, \"bytes_per_second\": %.0f, "
+            "\"write_syscalls_per_tape\": %.1f, \"peak_rss_kb\": %ld}\n",
+            program_length, options->sample_rate, output_path_names [path], iterations,
+            elapsed, samples / elapsed, bytes / elapsed,
+            (syscalls_start < 0) ? -1.0 : (double) (syscalls_end - syscalls_start) / iterations,
+            usage.ru_maxrss);
+    fflush (stdout);
+
+    return true;
+}
+
+
+/*
+ * Entry point.
+ */
+int main (int argc, char **argv)
+{
+    const uint16_t program_lengths [] = { 1024, 16384, 65535 };
+    uint32_t sample_rates [8] = { 9600, 44100 };
+    uint32_t sample_rate_count = 2;
+    double min_seconds = BENCH_DEFAULT_SECONDS;
+    bool rates_given = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp (argv [i], "--rate") == 0 && i + 1 < argc)
+        {
+            if (!rates_given)
+            {
+                sample_rate_count = 0;
+                rates_given = true;
+            }
+            if (sample_rate_count < 8)
+            {
+                sample_rates [sample_rate_count++] = strtoul (argv [++i], NULL, 10);
+            }
+        }
+        else if (strcmp (argv [i], "--time") == 0 && i + 1 < argc)
+        {
+            min_seconds = strtod (argv [++i], NULL);
+        }
+        else
+        {
+            fprintf (stderr, "Usage: %s [--rate <hz>]... [--time <seconds-per-case>]\n", argv [0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint8_t *program = malloc (TAPEWAVE_MAX_PROGRAM_LENGTH);
+    if (program == NULL)
+    {
+        fprintf (stderr, "Failed to allocate program.\n");
+        return EXIT_FAILURE;
+    }
+    synthetic_program (program, TAPEWAVE_MAX_PROGRAM_LENGTH);
+
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+    bool success = true;
+
+    for (uint32_t rate = 0; rate < sample_rate_count && success; rate++)
+    {
+        tapewave_options_t options;
+        tapewave_options_init (&options);
+        options.sample_rate = sample_rates [rate];
+
+        for (uint32_t length = 0; length < sizeof (program_lengths) / sizeof (program_lengths [0]) && success; length++)
+        {
+            for (output_path_t path = 0; path < OUTPUT_COUNT && success; path++)
+            {
+                success = bench_case (&encoder, &options, program, program_lengths [length], path, min_seconds);
+            }
+        }
+    }
+
+    tapewave_encoder_free (&encoder);
+    free (program);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,568 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "cache.h"
+
+#define CACHE_MAGIC "TWCACHE2"
+#define CACHE_KEY_EXTENSION ".key"
+
+/* Once over its size limit, the cache is trimmed to 7/8 of it, so that
+ * the stores that follow do not each need another scan to evict. */
+#define CACHE_TRIM_FRACTION 8
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ull
+#define FNV_PRIME           0x00000100000001b3ull
+
+/* An entry found while scanning the cache directory for eviction. */
+typedef struct cache_entry_s {
+    char *key_filename;
+    uint64_t size;
+    struct timespec last_used;
+} cache_entry_t;
+
+
+/*
+ * Continue a 64-bit FNV-1a hash over some data.
+ */
+static uint64_t fnv1a (uint64_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes [i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Initialise the running total of a cache's size.
+ */
+void cache_usage_init (cache_usage_t *usage)
+{
+    pthread_mutex_init (&usage->mutex, NULL);
+    usage->scanned = false;
+    usage->size = 0;
+}
+
+
+/*
+ * Build the key for a program rendered into a file with the given extension.
+ */
+void cache_key_init (cache_key_t *key, const char *extension, const tapewave_options_t *options,
+                     const char *name, const uint8_t *program, uint16_t program_length)
+{
+    /* Clear the padding too, so that it hashes and compares consistently */
+    memset (key, 0, sizeof (cache_key_t));
+    memcpy (key->header.magic, CACHE_MAGIC, sizeof (key->header.magic));
+    strncpy (key->header.extension, extension, sizeof (key->header.extension) - 1);
+    key->header.sample_rate = options->sample_rate;
+    key->header.turbo = options->turbo;
+    key->header.leader_bits = options->leader_bits;
+    key->header.gap_ms = options->gap_ms;
+    key->header.pad_ms = options->pad_ms;
+    key->header.program_length = program_length;
+
+    /* As on the tape, the file-name is padded with spaces */
+    size_t name_length = (name == NULL) ? 0 : strlen (name);
+    for (size_t i = 0; i < sizeof (key->header.name); i++)
+    {
+        key->header.name [i] = (i < name_length) ? name [i] : ' ';
+    }
+
+    key->program = program;
+    key->hash = fnv1a (FNV_OFFSET_BASIS, &key->header, sizeof (key->header));
+    key->hash = fnv1a (key->hash, program, program_length);
+}
+
+
+/*
+ * Get the path of a file within the cache directory for 'key'.
+ * The entry itself has the key's extension, and its key file has CACHE_KEY_EXTENSION added.
+ */
+static char *cache_filename (const cache_t *cache, const cache_key_t *key, bool key_file)
+{
+    const char *suffix = key_file ? CACHE_KEY_EXTENSION : "";
+    size_t filename_size = strlen (cache->directory) + 1 + 16 + strlen (key->header.extension) + strlen (suffix) + 1;
+    char *filename = malloc (filename_size);
+
+    if (filename != NULL)
+    {
+        snprintf (filename, filename_size, "%s/%016" PRIx64 "%s%s",
+                  cache->directory, key->hash, key->header.extension, suffix);
+    }
+
+    return filename;
+}
+
+
+/*
+ * Check that a key file holds exactly 'key', and not another that shares its hash.
+ */
+static bool cache_key_matches (const char *key_filename, const cache_key_t *key)
+{
+    FILE *key_file = fopen (key_filename, "r");
+    if (key_file == NULL)
+    {
+        return false;
+    }
+
+    cache_key_header_t header;
+    uint16_t program_length = key->header.program_length;
+    uint8_t *program = malloc (program_length + 1);
+    bool match = (program != NULL &&
+                  fread (&header, sizeof (header), 1, key_file) == 1 &&
+                  memcmp (&header, &key->header, sizeof (header)) == 0 &&
+                  fread (program, 1, program_length + 1, key_file) == program_length &&
+                  memcmp (program, key->program, program_length) == 0);
+
+    free (program);
+    fclose (key_file);
+
+    return match;
+}
+
+
+/*
+ * Copy the contents of one file to another, sharing its blocks if the file-system supports it.
+ */
+static bool copy_file (int source_fd, int destination_fd)
+{
+#ifdef FICLONE
+    if (ioctl (destination_fd, FICLONE, source_fd) == 0)
+    {
+        return true;
+    }
+#endif
+
+    uint8_t buffer [16384];
+    ssize_t read_size;
+
+    while ((read_size = read (source_fd, buffer, sizeof (buffer))) > 0)
+    {
+        for (ssize_t written = 0; written < read_size; )
+        {
+            ssize_t result = write (destination_fd, buffer + written, read_size - written);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            written += result;
+        }
+    }
+
+    return read_size == 0;
+}
+
+
+/*
+ * Create a temporary file in the cache directory, to be renamed into place once complete.
+ */
+static int cache_temp_file (const cache_t *cache, char **temp_filename)
+{
+    size_t temp_filename_size = strlen (cache->directory) + strlen ("/.tmp-XXXXXX") + 1;
+    *temp_filename = malloc (temp_filename_size);
+    if (*temp_filename == NULL)
+    {
+        return -1;
+    }
+    snprintf (*temp_filename, temp_filename_size, "%s/.tmp-XXXXXX", cache->directory);
+
+    int fd = mkstemp (*temp_filename);
+    if (fd < 0)
+    {
+        free (*temp_filename);
+        *temp_filename = NULL;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Place a copy of a cache entry at 'output_filename'. The copy is made next to
+ * the output, then renamed over it, so the output is never seen half-written.
+ */
+static bool cache_place (const char *entry_filename, const char *output_filename)
+{
+    size_t temp_filename_size = strlen (output_filename) + 5;
+    char *temp_filename = malloc (temp_filename_size);
+    int entry_fd = open (entry_filename, O_RDONLY);
+    bool success = false;
+
+    if (temp_filename == NULL || entry_fd < 0)
+    {
+        free (temp_filename);
+        if (entry_fd >= 0)
+        {
+            close (entry_fd);
+        }
+        return false;
+    }
+    snprintf (temp_filename, temp_filename_size, "%s.tmp", output_filename);
+    unlink (temp_filename);
+
+#ifdef FICLONE
+    int temp_fd = open (temp_filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (temp_fd >= 0)
+    {
+        success = (ioctl (temp_fd, FICLONE, entry_fd) == 0);
+        if (close (temp_fd) < 0)
+        {
+            success = false;
+        }
+        if (!success)
+        {
+            unlink (temp_filename);
+        }
+    }
+#endif
+
+    /* A hard-linked output is shared with the cache, so it is replaced rather than written through when rendered again */
+    if (!success)
+    {
+        success = (link (entry_filename, temp_filename) == 0);
+    }
+
+    if (!success)
+    {
+        int temp_fd = open (temp_filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (temp_fd >= 0)
+        {
+            success = copy_file (entry_fd, temp_fd);
+            if (close (temp_fd) < 0)
+            {
+                success = false;
+            }
+        }
+    }
+    close (entry_fd);
+
+    if (success && rename (temp_filename, output_filename) < 0)
+    {
+        success = false;
+    }
+
+    /* If the output was already a link to the entry, rename does nothing and the temporary link remains */
+    unlink (temp_filename);
+    free (temp_filename);
+
+    return success;
+}
+
+
+/*
+ * Place the cached file for 'key' at 'output_filename', as a reflink if the
+ * file-system supports it, otherwise as a hard link or a copy.
+ * Returns false if the file is not in the cache, or cannot be placed.
+ */
+bool cache_fetch (const cache_t *cache, const cache_key_t *key, const char *output_filename)
+{
+    char *key_filename = cache_filename (cache, key, true);
+    char *entry_filename = cache_filename (cache, key, false);
+    bool success = (key_filename != NULL && entry_filename != NULL &&
+                    cache_key_matches (key_filename, key) &&
+                    cache_place (entry_filename, output_filename));
+
+    /* The key file's modification time records when the entry was last used */
+    if (success)
+    {
+        utimensat (AT_FDCWD, key_filename, NULL, 0);
+    }
+
+    free (key_filename);
+    free (entry_filename);
+
+    return success;
+}
+
+
+/*
+ * Order entries from least to most recently used.
+ */
+static int cache_entry_compare (const void *a, const void *b)
+{
+    const cache_entry_t *entry_a = a;
+    const cache_entry_t *entry_b = b;
+
+    if (entry_a->last_used.tv_sec != entry_b->last_used.tv_sec)
+    {
+        return (entry_a->last_used.tv_sec < entry_b->last_used.tv_sec) ? -1 : 1;
+    }
+    if (entry_a->last_used.tv_nsec != entry_b->last_used.tv_nsec)
+    {
+        return (entry_a->last_used.tv_nsec < entry_b->last_used.tv_nsec) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Scan the cache directory for its size. If it is over the size limit, the
+ * least-recently used entries are evicted, along with their key files, until
+ * it is trimmed back below the limit. Outputs linked to them are unaffected.
+ * Returns the size of the cache once done.
+ */
+static uint64_t cache_evict (const cache_t *cache)
+{
+    DIR *directory = opendir (cache->directory);
+    if (directory == NULL)
+    {
+        return 0;
+    }
+
+    cache_entry_t *entries = NULL;
+    size_t entry_count = 0;
+    size_t entries_size = 0;
+    uint64_t total_size = 0;
+    struct dirent *dirent;
+    size_t directory_length = strlen (cache->directory);
+    size_t key_extension_length = strlen (CACHE_KEY_EXTENSION);
+
+    while ((dirent = readdir (directory)) != NULL)
+    {
+        size_t name_length = strlen (dirent->d_name);
+        if (dirent->d_name [0] == '.' || name_length <= key_extension_length ||
+            strcmp (dirent->d_name + name_length - key_extension_length, CACHE_KEY_EXTENSION) != 0)
+        {
+            continue;
+        }
+
+        if (entry_count == entries_size)
+        {
+            size_t size = (entries_size == 0) ? 64 : entries_size * 2;
+            cache_entry_t *resized = realloc (entries, size * sizeof (cache_entry_t));
+            if (resized == NULL)
+            {
+                break;
+            }
+            entries = resized;
+            entries_size = size;
+        }
+
+        cache_entry_t *entry = &entries [entry_count];
+        entry->key_filename = malloc (directory_length + 1 + name_length + 1);
+        if (entry->key_filename == NULL)
+        {
+            break;
+        }
+        sprintf (entry->key_filename, "%s/%s", cache->directory, dirent->d_name);
+
+        /* The entry's name is that of its key file, without the key extension */
+        struct stat key_stat;
+        struct stat entry_stat;
+        if (stat (entry->key_filename, &key_stat) < 0)
+        {
+            free (entry->key_filename);
+            continue;
+        }
+        entry->key_filename [directory_length + 1 + name_length - key_extension_length] = '\0';
+        entry->size = key_stat.st_size;
+        if (stat (entry->key_filename, &entry_stat) == 0)
+        {
+            entry->size += entry_stat.st_size;
+        }
+        entry->key_filename [directory_length + 1 + name_length - key_extension_length] = '.';
+        entry->last_used = key_stat.st_mtim;
+
+        total_size += entry->size;
+        entry_count++;
+    }
+    closedir (directory);
+
+    if (total_size > cache->max_size)
+    {
+        uint64_t trimmed_size = cache->max_size - cache->max_size / CACHE_TRIM_FRACTION;
+        qsort (entries, entry_count, sizeof (cache_entry_t), cache_entry_compare);
+
+        /* The entry is removed before its key file, so a key file without an entry is only ever a miss */
+        for (size_t i = 0; i < entry_count && total_size > trimmed_size; i++)
+        {
+            char *key_filename = entries [i].key_filename;
+            size_t entry_filename_length = strlen (key_filename) - key_extension_length;
+
+            key_filename [entry_filename_length] = '\0';
+            unlink (key_filename);
+            key_filename [entry_filename_length] = '.';
+            unlink (key_filename);
+
+            total_size -= entries [i].size;
+        }
+    }
+
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        free (entries [i].key_filename);
+    }
+    free (entries);
+
+    return total_size;
+}
+
+
+/*
+ * Count a newly stored entry of 'entry_size' bytes towards the size of the cache,
+ * evicting entries if that takes it over the limit. Entries stored by other
+ * processes sharing the directory are only counted at the next scan.
+ */
+static void cache_count (const cache_t *cache, uint64_t entry_size)
+{
+    cache_usage_t *usage = cache->usage;
+    if (usage == NULL)
+    {
+        cache_evict (cache);
+        return;
+    }
+
+    pthread_mutex_lock (&usage->mutex);
+
+    /* The first scan also counts the new entry */
+    if (!usage->scanned)
+    {
+        usage->size = cache_evict (cache);
+        usage->scanned = true;
+    }
+    else
+    {
+        usage->size += entry_size;
+        if (usage->size > cache->max_size)
+        {
+            usage->size = cache_evict (cache);
+        }
+    }
+
+    pthread_mutex_unlock (&usage->mutex);
+}
+
+
+/*
+ * Write the key file for an entry.
+ */
+static bool cache_write_key (const cache_t *cache, const cache_key_t *key, const char *key_filename)
+{
+    char *temp_filename;
+    int temp_fd = cache_temp_file (cache, &temp_filename);
+    if (temp_fd < 0)
+    {
+        return false;
+    }
+
+    FILE *key_file = fdopen (temp_fd, "w");
+    bool success = (key_file != NULL && fchmod (temp_fd, 0644) == 0 &&
+                    fwrite (&key->header, sizeof (key->header), 1, key_file) == 1 &&
+                    fwrite (key->program, 1, key->header.program_length, key_file) == key->header.program_length);
+
+    if ((key_file != NULL) ? (fclose (key_file) != 0) : (close (temp_fd) < 0))
+    {
+        success = false;
+    }
+    if (success && rename (temp_filename, key_filename) < 0)
+    {
+        success = false;
+    }
+    if (!success)
+    {
+        unlink (temp_filename);
+    }
+
+    free (temp_filename);
+
+    return success;
+}
+
+
+/*
+ * Write a copy of the output file as an entry. It is made read-only, as hard links to it are handed out.
+ */
+static bool cache_write_entry (const cache_t *cache, const char *output_filename, const char *entry_filename)
+{
+    char *temp_filename;
+    int temp_fd = cache_temp_file (cache, &temp_filename);
+    if (temp_fd < 0)
+    {
+        return false;
+    }
+
+    int output_fd = open (output_filename, O_RDONLY);
+    bool success = (output_fd >= 0 && copy_file (output_fd, temp_fd) && fchmod (temp_fd, 0444) == 0);
+
+    if (output_fd >= 0)
+    {
+        close (output_fd);
+    }
+    if (close (temp_fd) < 0)
+    {
+        success = false;
+    }
+    if (success && rename (temp_filename, entry_filename) < 0)
+    {
+        success = false;
+    }
+    if (!success)
+    {
+        unlink (temp_filename);
+    }
+
+    free (temp_filename);
+
+    return success;
+}
+
+
+/*
+ * Store a copy of the file rendered for 'key' in the cache. If that takes the
+ * cache over its size limit, the least-recently used entries are evicted.
+ */
+bool cache_store (const cache_t *cache, const cache_key_t *key, const char *output_filename)
+{
+    char *key_filename = cache_filename (cache, key, true);
+    char *entry_filename = cache_filename (cache, key, false);
+
+    /* The key file is written first, as an entry without its key file could never be hit */
+    bool success = (key_filename != NULL && entry_filename != NULL &&
+                    (mkdir (cache->directory, 0755) == 0 || errno == EEXIST) &&
+                    cache_write_key (cache, key, key_filename) &&
+                    cache_write_entry (cache, output_filename, entry_filename));
+
+    struct stat entry_stat;
+    if (success && stat (entry_filename, &entry_stat) == 0)
+    {
+        cache_count (cache, sizeof (key->header) + key->header.program_length + entry_stat.st_size);
+    }
+
+    free (key_filename);
+    free (entry_filename);
+
+    return success;
+}
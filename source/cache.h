@@ -0,0 +1,81 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tapewave.h"
+
+/* Size limit of a cache directory, when not given. */
+#define CACHE_DEFAULT_SIZE  (1024ull * 1024 * 1024)
+
+/* Running total of the size of a cache directory, shared between the threads storing to it.
+ * It is found by scanning the directory on the first store, and then kept up to date, so
+ * that the directory only needs scanning again once the total crosses the size limit. */
+typedef struct cache_usage_s {
+    pthread_mutex_t mutex;
+    bool scanned;
+    uint64_t size;
+} cache_usage_t;
+
+/* Directory of rendered files, addressed by the hash of what was rendered. */
+typedef struct cache_s {
+    const char *directory;  /* NULL if caching is disabled */
+    uint64_t max_size;      /* Least-recently used entries are evicted beyond this many bytes */
+    cache_usage_t *usage;   /* If NULL, the directory is scanned on every store */
+} cache_t;
+
+/* Everything that determines the contents of a rendered file. Stored alongside each
+ * entry, so that a hash collision is never mistaken for a hit. */
+typedef struct cache_key_header_s {
+    char magic [8];
+    char extension [8];
+    uint32_t sample_rate;
+    uint32_t turbo;
+    uint32_t leader_bits;
+    uint32_t gap_ms;
+    uint32_t pad_ms;
+    uint16_t program_length;
+    char name [16];
+} cache_key_header_t;
+
+typedef struct cache_key_s {
+    cache_key_header_t header;
+    const uint8_t *program;
+    uint64_t hash;
+} cache_key_t;
+
+
+/*
+ * Initialise the running total of a cache's size, before its first store.
+ */
+void cache_usage_init (cache_usage_t *usage);
+
+/*
+ * Build the key for a program rendered into a file with the given extension.
+ */
+void cache_key_init (cache_key_t *key, const char *extension, const tapewave_options_t *options,
+                     const char *name, const uint8_t *program, uint16_t program_length);
+
+/*
+ * Place the cached file for 'key' at 'output_filename', as a reflink if the
+ * file-system supports it, otherwise as a hard link or a copy.
+ * Returns false if the file is not in the cache, or cannot be placed.
+ */
+bool cache_fetch (const cache_t *cache, const cache_key_t *key, const char *output_filename);
+
+/*
+ * Store a copy of the file rendered for 'key' in the cache. If that takes the
+ * cache over its size limit, the least-recently used entries are evicted.
+ */
+bool cache_store (const cache_t *cache, const cache_key_t *key, const char *output_filename);
+
+#endif /* CACHE_H */
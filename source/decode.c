@@ -0,0 +1,481 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tapewave.h"
+#include "pulse.h"
+
+/* Number of pulse widths to find in each call to the pulse-width kernel. */
+#define PULSE_BUFFER_SIZE   4096
+
+/* Minimum number of consecutive 2400 Hz half-cycles to be recognised as a leader. */
+#define LEADER_MIN_HALVES   (4 * 200)
+
+/* Maximum number of idle '1' bits accepted between the stop bits and the next start bit. */
+#define IDLE_MAX_BITS       32
+
+/* Classification of a half-cycle of the tape signal. */
+typedef enum half_e {
+    HALF_SHORT,     /* Half a cycle at 2400 Hz, a quarter of a '1' bit */
+    HALF_LONG,      /* Half a cycle at 1200 Hz, half of a '0' bit */
+    HALF_GAP,       /* Silence or noise, too long to be part of a bit */
+    HALF_END        /* End of the recording */
+} half_t;
+
+/* State for reading programs back out of a tape recording. */
+struct tapewave_decoder_s {
+    const uint8_t *samples;
+    size_t sample_count;
+    uint32_t sample_rate;
+
+    /* Samples converted to unsigned 8-bit mono, if the recording was in another format */
+    uint8_t *converted;
+
+    /* Half-cycles longer than this many samples are long, and longer than gap_threshold are gaps */
+    uint32_t long_threshold;
+    uint32_t gap_threshold;
+
+    /* Pulse widths found by the pulse-width kernel, not yet consumed */
+    pulse_state_t pulse_state;
+    uint32_t widths [PULSE_BUFFER_SIZE];
+    size_t width_count;
+    size_t width_index;
+
+    /* Sample index of the edge that ended the most recently consumed half-cycle */
+    size_t edge_position;
+
+    /* Sample index where the most recent leader started */
+    size_t leader_position;
+};
+
+
+/*
+ * Read a little-endian 16-bit value.
+ */
+static uint16_t read_u16 (const uint8_t *data)
+{
+    return data [0] | (data [1] << 8);
+}
+
+
+/*
+ * Read a little-endian 32-bit value.
+ */
+static uint32_t read_u32 (const uint8_t *data)
+{
+    return data [0] | (data [1] << 8) | (data [2] << 16) | ((uint32_t) data [3] << 24);
+}
+
+
+/*
+ * Parse the RIFF structure of a wave file, locating its samples.
+ * Anything other than unsigned 8-bit mono is converted to it.
+ */
+static tapewave_decode_result_t parse_wav (tapewave_decoder_t *decoder, const uint8_t *wav, size_t wav_size)
+{
+    const uint8_t *format = NULL;
+    const uint8_t *data = NULL;
+    size_t data_size = 0;
+
+    if (wav_size < 12 || memcmp (wav, "RIFF", 4) != 0 || memcmp (wav + 8, "WAVE", 4) != 0)
+    {
+        return TAPEWAVE_DECODE_BAD_WAV;
+    }
+
+    /* Find the format and data chunks */
+    size_t offset = 12;
+    while (offset + 8 <= wav_size && data == NULL)
+    {
+        const uint8_t *chunk = wav + offset;
+        size_t chunk_size = read_u32 (chunk + 4);
+
+        /* Recordings that were streamed may have a data size that runs past the end of the file */
+        if (chunk_size > wav_size - offset - 8)
+        {
+            chunk_size = wav_size - offset - 8;
+        }
+
+        if (memcmp (chunk, "fmt ", 4) == 0 && chunk_size >= 16)
+        {
+            format = chunk + 8;
+        }
+        else if (memcmp (chunk, "data", 4) == 0)
+        {
+            data = chunk + 8;
+            data_size = chunk_size;
+        }
+
+        /* Chunks are padded to an even length */
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (format == NULL || data == NULL)
+    {
+        return TAPEWAVE_DECODE_BAD_WAV;
+    }
+
+    uint16_t format_type = read_u16 (format);
+    uint16_t format_channels = read_u16 (format + 2);
+    uint32_t format_sample_rate = read_u32 (format + 4);
+    uint16_t format_block_align = read_u16 (format + 12);
+    uint16_t format_bits_per_sample = read_u16 (format + 14);
+
+    /* Accept PCM, or WAVE_FORMAT_EXTENSIBLE which is assumed to hold PCM */
+    if ((format_type != 1 && format_type != 0xfffe) || format_channels == 0 || format_sample_rate < 4800 ||
+        (format_bits_per_sample != 8 && format_bits_per_sample != 16) ||
+        format_block_align != format_channels * format_bits_per_sample / 8)
+    {
+        return TAPEWAVE_DECODE_BAD_WAV;
+    }
+
+    decoder->sample_rate = format_sample_rate;
+    decoder->sample_count = data_size / format_block_align;
+
+    if (format_bits_per_sample == 8 && format_channels == 1)
+    {
+        decoder->samples = data;
+        return TAPEWAVE_DECODE_OK;
+    }
+
+    /* Keep only the first channel, and the most significant byte of 16-bit samples */
+    decoder->converted = malloc (decoder->sample_count + 1);
+    if (decoder->converted == NULL)
+    {
+        return TAPEWAVE_DECODE_NO_MEMORY;
+    }
+
+    for (size_t i = 0; i < decoder->sample_count; i++)
+    {
+        const uint8_t *frame = data + i * format_block_align;
+        decoder->converted [i] = (format_bits_per_sample == 8) ? frame [0] : (uint8_t) (frame [1] + 0x80);
+    }
+    decoder->samples = decoder->converted;
+
+    return TAPEWAVE_DECODE_OK;
+}
+
+
+/*
+ * Get the next half-cycle of the signal.
+ */
+static half_t next_half (tapewave_decoder_t *decoder)
+{
+    if (decoder->width_index == decoder->width_count)
+    {
+        decoder->width_count = pulse_widths (decoder->samples, decoder->sample_count, &decoder->pulse_state,
+                                             decoder->widths, PULSE_BUFFER_SIZE);
+        decoder->width_index = 0;
+
+        if (decoder->width_count == 0)
+        {
+            return HALF_END;
+        }
+    }
+
+    uint32_t width = decoder->widths [decoder->width_index++];
+    decoder->edge_position += width;
+
+    if (width > decoder->gap_threshold)
+    {
+        return HALF_GAP;
+    }
+
+    return (width > decoder->long_threshold) ? HALF_LONG : HALF_SHORT;
+}
+
+
+/*
+ * Push back the half-cycle most recently returned by next_half.
+ */
+static void unread_half (tapewave_decoder_t *decoder)
+{
+    decoder->width_index--;
+    decoder->edge_position -= decoder->widths [decoder->width_index];
+}
+
+
+/*
+ * Read a single bit cell.
+ * Returns the bit's value, or -1 if the signal does not form a valid bit.
+ */
+static int read_bit (tapewave_decoder_t *decoder)
+{
+    half_t half = next_half (decoder);
+
+    /* A '0' is one cycle at 1200 Hz */
+    if (half == HALF_LONG)
+    {
+        return (next_half (decoder) == HALF_LONG) ? 0 : -1;
+    }
+
+    /* A '1' is two cycles at 2400 Hz */
+    if (half == HALF_SHORT)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (next_half (decoder) != HALF_SHORT)
+            {
+                return -1;
+            }
+        }
+        return 1;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Read a byte, framed by a start bit and two stop bits.
+ * Returns the byte's value, or -1 if the signal does not form a valid byte.
+ */
+static int read_byte (tapewave_decoder_t *decoder)
+{
+    int bit;
+    int idle_bits = 0;
+    uint8_t byte = 0;
+
+    /* Skip any idle '1' bits until the start bit */
+    while ((bit = read_bit (decoder)) == 1)
+    {
+        if (++idle_bits > IDLE_MAX_BITS)
+        {
+            return -1;
+        }
+    }
+    if (bit < 0)
+    {
+        return -1;
+    }
+
+    /* Data bits, least significant first */
+    for (int i = 0; i < 8; i++)
+    {
+        if ((bit = read_bit (decoder)) < 0)
+        {
+            return -1;
+        }
+        byte |= bit << i;
+    }
+
+    /* Stop bits */
+    if (read_bit (decoder) != 1 || read_bit (decoder) != 1)
+    {
+        return -1;
+    }
+
+    return byte;
+}
+
+
+/*
+ * Find the next leader field, and position the decoder at the start bit following it.
+ * Returns false if the end of the recording is reached first.
+ */
+static bool find_leader (tapewave_decoder_t *decoder)
+{
+    uint32_t short_count = 0;
+
+    while (true)
+    {
+        half_t half = next_half (decoder);
+
+        if (half == HALF_SHORT)
+        {
+            if (short_count++ == 0)
+            {
+                decoder->leader_position = decoder->edge_position - decoder->widths [decoder->width_index - 1];
+            }
+        }
+        else if (half == HALF_END)
+        {
+            return false;
+        }
+        else if (short_count >= LEADER_MIN_HALVES)
+        {
+            unread_half (decoder);
+            return true;
+        }
+        else
+        {
+            short_count = 0;
+        }
+    }
+}
+
+
+/*
+ * Read 'length' bytes into 'data', adding them to 'checksum'.
+ * Returns false if the signal does not form valid bytes.
+ */
+static bool read_bytes (tapewave_decoder_t *decoder, uint8_t *data, uint32_t length, uint8_t *checksum)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        int byte = read_byte (decoder);
+
+        if (byte < 0)
+        {
+            return false;
+        }
+
+        data [i] = byte;
+        *checksum += byte;
+    }
+
+    return true;
+}
+
+
+/*
+ * Open a decoder for a wave file held in memory.
+ */
+tapewave_decoder_t *tapewave_decoder_open (const uint8_t *wav, size_t wav_size, tapewave_decode_result_t *result)
+{
+    tapewave_decoder_t *decoder = calloc (1, sizeof (tapewave_decoder_t));
+    if (decoder == NULL)
+    {
+        *result = TAPEWAVE_DECODE_NO_MEMORY;
+        return NULL;
+    }
+
+    *result = parse_wav (decoder, wav, wav_size);
+    if (*result != TAPEWAVE_DECODE_OK)
+    {
+        tapewave_decoder_close (decoder);
+        return NULL;
+    }
+
+    /* Long half-cycles are 1/2400 s, and short half-cycles are 1/4800 s.
+     * Split them at 1/3200 s, and treat anything over 1/800 s as a gap. */
+    decoder->long_threshold = decoder->sample_rate / 3200;
+    decoder->gap_threshold = decoder->sample_rate / 800;
+
+    return decoder;
+}
+
+
+/*
+ * Close a decoder, freeing its memory.
+ */
+void tapewave_decoder_close (tapewave_decoder_t *decoder)
+{
+    if (decoder != NULL)
+    {
+        free (decoder->converted);
+        free (decoder);
+    }
+}
+
+
+/*
+ * Decode the next program in the recording.
+ */
+tapewave_decode_result_t tapewave_decoder_next (tapewave_decoder_t *decoder, tapewave_program_t *program)
+{
+    uint8_t header [16 + 2 + 1];
+    uint8_t checksum = 0;
+
+    memset (program, 0, sizeof (tapewave_program_t));
+
+    /* Find a header block, skipping anything else */
+    while (true)
+    {
+        if (!find_leader (decoder))
+        {
+            return TAPEWAVE_DECODE_END;
+        }
+
+        program->start_time = (double) decoder->leader_position / decoder->sample_rate;
+
+        if (read_byte (decoder) == 0x16)
+        {
+            break;
+        }
+    }
+
+    /* File-name, program length, and parity byte */
+    if (!read_bytes (decoder, header, sizeof (header), &checksum))
+    {
+        return TAPEWAVE_DECODE_TRUNCATED;
+    }
+
+    memcpy (program->name, header, 16);
+    for (int i = 15; i >= 0 && program->name [i] == ' '; i--)
+    {
+        program->name [i] = '\0';
+    }
+    program->length = (header [16] << 8) | header [17];
+
+    if (checksum != 0)
+    {
+        return TAPEWAVE_DECODE_HEADER_PARITY;
+    }
+
+    /* The program block follows its own leader field */
+    if (!find_leader (decoder) || read_byte (decoder) != 0x17)
+    {
+        return TAPEWAVE_DECODE_NO_PROGRAM;
+    }
+
+    program->data = malloc (program->length + 1);
+    if (program->data == NULL)
+    {
+        return TAPEWAVE_DECODE_NO_MEMORY;
+    }
+
+    uint8_t parity;
+    checksum = 0;
+    if (!read_bytes (decoder, program->data, program->length, &checksum) ||
+        !read_bytes (decoder, &parity, 1, &checksum))
+    {
+        return TAPEWAVE_DECODE_TRUNCATED;
+    }
+
+    if (checksum != 0)
+    {
+        return TAPEWAVE_DECODE_PROGRAM_PARITY;
+    }
+
+    return TAPEWAVE_DECODE_OK;
+}
+
+
+/*
+ * Free the data held by a decoded program.
+ */
+void tapewave_program_free (tapewave_program_t *program)
+{
+    free (program->data);
+    program->data = NULL;
+}
+
+
+/*
+ * Get a description of a decode result.
+ */
+const char *tapewave_decode_result_string (tapewave_decode_result_t result)
+{
+    switch (result)
+    {
+        case TAPEWAVE_DECODE_OK:                return "ok";
+        case TAPEWAVE_DECODE_END:               return "no further programs";
+        case TAPEWAVE_DECODE_BAD_WAV:           return "not a supported PCM wave file";
+        case TAPEWAVE_DECODE_TRUNCATED:         return "block is truncated or damaged";
+        case TAPEWAVE_DECODE_NO_PROGRAM:        return "header block is not followed by a program block";
+        case TAPEWAVE_DECODE_HEADER_PARITY:     return "header block parity error";
+        case TAPEWAVE_DECODE_PROGRAM_PARITY:    return "program block parity error";
+        case TAPEWAVE_DECODE_NO_MEMORY:         return "out of memory";
+    }
+
+    return "unknown error";
+}
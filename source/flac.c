@@ -0,0 +1,477 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wave_table.h"
+#include "flac.h"
+
+/* Limits on the partitioned Rice coding of residuals. Parameter 15 is an escape code,
+ * used here only for partitions where every residual is zero. */
+#define RICE_MAX_PARAMETER      14
+#define RICE_ESCAPE             15
+#define MAX_PARTITION_ORDER     10
+
+/* The highest predictor order of a FLAC LPC subframe. */
+#define LPC_MAX_ORDER           32
+
+typedef enum subframe_type_e {
+    SUBFRAME_CONSTANT,
+    SUBFRAME_VERBATIM,
+    SUBFRAME_FIXED,     /* First-order polynomial predictor, repeating the previous sample */
+    SUBFRAME_LAG        /* LPC predictor with a single tap, repeating the sample 'order' samples ago */
+} subframe_type_t;
+
+/* Choice of partitions and Rice parameters for a residual. */
+typedef struct rice_plan_s {
+    uint32_t partition_order;
+    uint8_t parameters [1 << MAX_PARTITION_ORDER];
+    uint64_t bits;
+} rice_plan_t;
+
+/* Bits written most-significant first into a byte buffer. */
+typedef struct bit_writer_s {
+    uint8_t *buffer;
+    size_t position;
+    uint64_t accumulator;
+    uint32_t bits;
+} bit_writer_t;
+
+
+/*
+ * Write the low 'count' bits of 'value', where 'count' is at most 32.
+ */
+static void bits_put (bit_writer_t *writer, uint32_t value, uint32_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    writer->accumulator = (writer->accumulator << count) | (value & (UINT32_MAX >> (32 - count)));
+    writer->bits += count;
+
+    while (writer->bits >= 8)
+    {
+        writer->bits -= 8;
+        writer->buffer [writer->position++] = writer->accumulator >> writer->bits;
+    }
+}
+
+
+/*
+ * Write 'value' in unary: 'value' zeros, then a one.
+ */
+static void bits_put_unary (bit_writer_t *writer, uint32_t value)
+{
+    while (value >= 32)
+    {
+        bits_put (writer, 0, 32);
+        value -= 32;
+    }
+
+    bits_put (writer, 1, value + 1);
+}
+
+
+/*
+ * Pad with zeros up to the next byte boundary.
+ */
+static void bits_align (bit_writer_t *writer)
+{
+    if (writer->bits > 0)
+    {
+        bits_put (writer, 0, 8 - writer->bits);
+    }
+}
+
+
+/*
+ * CRC-8 of the frame header, with polynomial x^8 + x^2 + x + 1.
+ */
+static uint8_t crc8 (const uint8_t *data, size_t length)
+{
+    uint8_t crc = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data [i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+
+/*
+ * CRC-16 of the whole frame, with polynomial x^16 + x^15 + x^2 + 1.
+ */
+static uint16_t crc16 (const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data [i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+
+/*
+ * Write the stream marker and STREAMINFO block.
+ */
+void flac_stream_header (uint8_t *buffer, uint32_t sample_rate, uint64_t total_samples)
+{
+    bit_writer_t writer = { .buffer = buffer };
+
+    memcpy (buffer, "fLaC", 4);
+    writer.position = 4;
+
+    /* Metadata block header: last block, type 0 (STREAMINFO), 34 bytes */
+    bits_put (&writer, 1, 1);
+    bits_put (&writer, 0, 7);
+    bits_put (&writer, 34, 24);
+
+    bits_put (&writer, FLAC_BLOCK_SIZE, 16);        /* Minimum block size */
+    bits_put (&writer, FLAC_BLOCK_SIZE, 16);        /* Maximum block size */
+    bits_put (&writer, 0, 24);                      /* Minimum frame size, unknown */
+    bits_put (&writer, 0, 24);                      /* Maximum frame size, unknown */
+    bits_put (&writer, sample_rate, 20);
+    bits_put (&writer, 1 - 1, 3);                   /* Channels, minus one */
+    bits_put (&writer, 8 - 1, 5);                   /* Bits per sample, minus one */
+    bits_put (&writer, total_samples >> 32, 4);
+    bits_put (&writer, total_samples, 32);
+
+    /* The MD5 signature of the audio is left as zero, meaning not calculated */
+    memset (buffer + writer.position, 0, 16);
+}
+
+
+/*
+ * Calculate the residual of predicting each sample as the one 'order' samples before it,
+ * folded to an unsigned value for Rice coding. Only entries from 'order' onwards are written.
+ */
+static void predict (const int32_t *samples, uint32_t count, uint32_t order, uint32_t *folded)
+{
+    for (uint32_t i = order; i < count; i++)
+    {
+        /* A first-order fixed predictor is the same as a lag of one sample */
+        int32_t residual = samples [i] - samples [i - order];
+
+        folded [i] = (residual >= 0) ? (uint32_t) residual << 1 : ((uint32_t) -residual << 1) - 1;
+    }
+}
+
+
+/*
+ * Find the partition order and Rice parameters that code a residual in the fewest bits.
+ *
+ * The cost of coding each of the smallest partitions is found for every parameter.
+ * Larger partitions are then costed by merging pairs, so each residual is only read once.
+ */
+static void rice_plan (const uint32_t *folded, uint32_t count, uint32_t order, rice_plan_t *plan)
+{
+    uint32_t sums [1 << MAX_PARTITION_ORDER] [RICE_MAX_PARAMETER + 1];
+
+    /* Partitions must evenly divide the block, and the first must be longer than the warm-up */
+    uint32_t max_order = 0;
+    while (max_order < MAX_PARTITION_ORDER && count % (2u << max_order) == 0 && (count >> (max_order + 1)) > order)
+    {
+        max_order++;
+    }
+
+    uint32_t partition_size = count >> max_order;
+    for (uint32_t p = 0; p < (1u << max_order); p++)
+    {
+        memset (sums [p], 0, sizeof (sums [p]));
+        for (uint32_t i = (p == 0) ? order : p * partition_size; i < (p + 1) * partition_size; i++)
+        {
+            /* Most residuals of a well-predicted square wave are zero */
+            if (folded [i] == 0)
+            {
+                continue;
+            }
+
+            for (uint32_t k = 0; k <= RICE_MAX_PARAMETER; k++)
+            {
+                sums [p] [k] += folded [i] >> k;
+            }
+        }
+    }
+
+    plan->bits = UINT64_MAX;
+    for (int32_t partition_order = max_order; partition_order >= 0; partition_order--)
+    {
+        uint32_t partitions = 1u << partition_order;
+        uint8_t parameters [1 << MAX_PARTITION_ORDER];
+        uint64_t bits = 0;
+
+        if (partition_order < max_order)
+        {
+            for (uint32_t p = 0; p < partitions; p++)
+            {
+                if (sums [p * 2] [0] == 0 && sums [p * 2 + 1] [0] == 0)
+                {
+                    memset (sums [p], 0, sizeof (sums [p]));
+                    continue;
+                }
+                for (uint32_t k = 0; k <= RICE_MAX_PARAMETER; k++)
+                {
+                    sums [p] [k] = sums [p * 2] [k] + sums [p * 2 + 1] [k];
+                }
+            }
+        }
+
+        /* Each value costs its quotient in unary, a stop bit, and 'k' low bits. A partition
+         * of zeros is escaped with a width of zero bits, costing nothing per value. */
+        for (uint32_t p = 0; p < partitions; p++)
+        {
+            uint32_t n = (count >> partition_order) - ((p == 0) ? order : 0);
+            uint64_t best_bits = UINT64_MAX;
+
+            /* A partition of zeros needs no parameter */
+            if (sums [p] [0] == 0)
+            {
+                parameters [p] = (n < 5) ? 0 : RICE_ESCAPE;
+                bits += 4 + ((n < 5) ? n : 5);
+                continue;
+            }
+
+            for (uint32_t k = 0; k <= RICE_MAX_PARAMETER; k++)
+            {
+                uint64_t k_bits = (uint64_t) n * (k + 1) + sums [p] [k];
+                if (k_bits < best_bits)
+                {
+                    best_bits = k_bits;
+                    parameters [p] = k;
+                }
+            }
+
+            bits += 4 + best_bits;
+        }
+
+        if (bits < plan->bits)
+        {
+            plan->bits = bits;
+            plan->partition_order = partition_order;
+            memcpy (plan->parameters, parameters, partitions);
+        }
+    }
+
+    /* Coding method and partition order */
+    plan->bits += 2 + 4;
+}
+
+
+/*
+ * Write a residual, using the partitions and parameters from rice_plan ().
+ */
+static void write_residual (bit_writer_t *writer, const uint32_t *folded, uint32_t count, uint32_t order,
+                            const rice_plan_t *plan)
+{
+    uint32_t partitions = 1u << plan->partition_order;
+    uint32_t partition_size = count >> plan->partition_order;
+
+    bits_put (writer, 0, 2);    /* Rice coding with 4-bit parameters */
+    bits_put (writer, plan->partition_order, 4);
+
+    for (uint32_t p = 0; p < partitions; p++)
+    {
+        uint32_t k = plan->parameters [p];
+        bits_put (writer, k, 4);
+
+        if (k == RICE_ESCAPE)
+        {
+            bits_put (writer, 0, 5);
+            continue;
+        }
+
+        for (uint32_t i = (p == 0) ? order : p * partition_size; i < (p + 1) * partition_size; i++)
+        {
+            bits_put_unary (writer, folded [i] >> k);
+            bits_put (writer, folded [i], k);
+        }
+    }
+}
+
+
+/*
+ * Write the frame number, in the UTF-8 style variable-length coding used by FLAC.
+ */
+static void write_frame_number (bit_writer_t *writer, uint32_t frame_number)
+{
+    if (frame_number < 0x80)
+    {
+        bits_put (writer, frame_number, 8);
+        return;
+    }
+
+    /* Count the continuation bytes, each holding six bits */
+    uint32_t extra_bytes = 1;
+    while (extra_bytes < 5 && (frame_number >> (6 * extra_bytes)) >= (0x40u >> extra_bytes))
+    {
+        extra_bytes++;
+    }
+
+    uint32_t lead_mask = (0xff00u >> (extra_bytes + 1)) & 0xff;
+    bits_put (writer, lead_mask | (frame_number >> (6 * extra_bytes)), 8);
+
+    for (int32_t i = extra_bytes - 1; i >= 0; i--)
+    {
+        bits_put (writer, 0x80 | ((frame_number >> (6 * i)) & 0x3f), 8);
+    }
+}
+
+
+/*
+ * Encode up to FLAC_BLOCK_SIZE samples as a single frame.
+ *
+ * The tape signal has only three levels, so whole blocks of silence become
+ * constant subframes, and the square waves leave a residual of zero except
+ * at their edges once predicted. Each predictor is costed exactly, and the
+ * cheapest is used, falling back to verbatim samples.
+ */
+size_t flac_encode_frame (const uint8_t *samples, uint32_t count, uint32_t frame_number,
+                          uint32_t sample_rate, uint8_t *buffer)
+{
+    int32_t signed_samples [FLAC_BLOCK_SIZE];
+    uint32_t folded [FLAC_BLOCK_SIZE];
+    bit_writer_t writer = { .buffer = buffer };
+
+    /* FLAC stores 8-bit samples as signed values */
+    bool constant = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        signed_samples [i] = (int32_t) samples [i] - 0x80;
+        constant &= (samples [i] == samples [0]);
+    }
+
+    /* Frame header: sync code and fixed block size */
+    bits_put (&writer, 0x3ffe, 14);
+    bits_put (&writer, 0, 1);
+    bits_put (&writer, 0, 1);
+
+    /* A full block uses the code for 4096 samples, and a short final block stores its size at the end of the header */
+    bits_put (&writer, (count == FLAC_BLOCK_SIZE) ? 0xc : 0x7, 4);
+    bits_put (&writer, 0, 4);   /* Sample rate from STREAMINFO */
+    bits_put (&writer, 0, 4);   /* Mono */
+    bits_put (&writer, 1, 3);   /* 8 bits per sample */
+    bits_put (&writer, 0, 1);
+    write_frame_number (&writer, frame_number);
+    if (count != FLAC_BLOCK_SIZE)
+    {
+        bits_put (&writer, count - 1, 16);
+    }
+    bits_put (&writer, crc8 (buffer, writer.position), 8);
+
+    /* Find the cheapest predictor. The lags of one '0' bit and one '1' bit
+     * cycle repeat the wave exactly, when they are a whole number of samples. */
+    subframe_type_t best_type = constant ? SUBFRAME_CONSTANT : SUBFRAME_VERBATIM;
+    uint32_t best_order = 0;
+    uint64_t best_bits = 8 * (uint64_t) count;
+    rice_plan_t best_plan;
+
+    const struct {
+        subframe_type_t type;
+        uint32_t order;
+    } candidates [] = {
+        { SUBFRAME_FIXED, 1 },
+        { SUBFRAME_LAG, sample_rate / BAUD_RATE },
+        { SUBFRAME_LAG, sample_rate / (BAUD_RATE * 2) }
+    };
+
+    for (uint32_t c = 0; c < sizeof (candidates) / sizeof (candidates [0]) && !constant; c++)
+    {
+        subframe_type_t type = candidates [c].type;
+        uint32_t order = candidates [c].order;
+        rice_plan_t plan;
+
+        if (order >= count || (type == SUBFRAME_LAG && (order < 2 || order > LPC_MAX_ORDER)))
+        {
+            continue;
+        }
+
+        predict (signed_samples, count, order, folded);
+        rice_plan (folded, count, order, &plan);
+
+        /* Warm-up samples, and for LPC, the precision, shift, and coefficients */
+        uint64_t bits = 8 * order + plan.bits + ((type == SUBFRAME_LAG) ? 4 + 5 + 2 * order : 0);
+        if (bits < best_bits)
+        {
+            best_type = type;
+            best_order = order;
+            best_bits = bits;
+            best_plan = plan;
+        }
+    }
+
+    /* Subframe header: padding bit, type, and no wasted bits */
+    switch (best_type)
+    {
+        case SUBFRAME_CONSTANT:
+            bits_put (&writer, 0x00, 8);
+            bits_put (&writer, signed_samples [0], 8);
+            break;
+
+        case SUBFRAME_VERBATIM:
+            bits_put (&writer, 0x01 << 1, 8);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                bits_put (&writer, signed_samples [i], 8);
+            }
+            break;
+
+        case SUBFRAME_FIXED:
+        case SUBFRAME_LAG:
+            if (best_type == SUBFRAME_FIXED)
+            {
+                bits_put (&writer, (0x08 | best_order) << 1, 8);
+            }
+            else
+            {
+                bits_put (&writer, (0x20 | (best_order - 1)) << 1, 8);
+            }
+
+            for (uint32_t i = 0; i < best_order; i++)
+            {
+                bits_put (&writer, signed_samples [i], 8);
+            }
+
+            /* A single coefficient of one, on the oldest sample, with two bits of precision and no shift */
+            if (best_type == SUBFRAME_LAG)
+            {
+                bits_put (&writer, 2 - 1, 4);
+                bits_put (&writer, 0, 5);
+                for (uint32_t i = 0; i < best_order; i++)
+                {
+                    bits_put (&writer, (i == best_order - 1) ? 1 : 0, 2);
+                }
+            }
+
+            predict (signed_samples, count, best_order, folded);
+            write_residual (&writer, folded, count, best_order, &best_plan);
+            break;
+    }
+
+    /* Frame footer */
+    bits_align (&writer);
+    bits_put (&writer, crc16 (buffer, writer.position), 16);
+
+    return writer.position;
+}
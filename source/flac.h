@@ -0,0 +1,36 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef FLAC_H
+#define FLAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Samples per FLAC frame. The final frame of a stream may be shorter. */
+#define FLAC_BLOCK_SIZE         4096
+
+/* Stream marker, metadata block header, and STREAMINFO block. */
+#define FLAC_STREAM_HEADER_SIZE (4 + 4 + 34)
+
+/* Upper bound on the size of a frame: the frame header, a verbatim subframe, and the footer. */
+#define FLAC_MAX_FRAME_SIZE     (16 + 1 + FLAC_BLOCK_SIZE + 2)
+
+
+/*
+ * Write the stream marker and STREAMINFO block, describing 8-bit mono audio.
+ */
+void flac_stream_header (uint8_t *buffer, uint32_t sample_rate, uint64_t total_samples);
+
+/*
+ * Encode up to FLAC_BLOCK_SIZE unsigned 8-bit samples as a single frame.
+ * Returns the number of bytes written to 'buffer', at most FLAC_MAX_FRAME_SIZE.
+ */
+size_t flac_encode_frame (const uint8_t *samples, uint32_t count, uint32_t frame_number,
+                          uint32_t sample_rate, uint8_t *buffer);
+
+#endif /* FLAC_H */
@@ -5,259 +5,2111 @@
  * JoppyFurr 2024
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tapewave.h"
+#include "cache.h"
+#include "pack.h"
+
+/* Command-line settings for how each tape is rendered and written. */
+typedef struct encode_settings_s {
+    tapewave_options_t options;
+    bool use_mmap;      /* Render directly into a memory-mapping of the output file */
+    bool incremental;   /* Patch the changed bytes of an existing output file, using its sidecar */
+    cache_t cache;      /* Previously rendered files to reuse */
+    bool compress;      /* Replace each program with a copy that unpacks itself, where that loads faster */
+} encode_settings_t;
+
+/* Output file formats, chosen by the output filename's extension. */
+typedef enum output_format_e {
+    OUTPUT_WAV,
+    OUTPUT_FLAC,
+    OUTPUT_TZX,
+    OUTPUT_UNKNOWN
+} output_format_t;
+
+/* Growable buffer for files rendered into memory. */
+typedef struct memory_output_s {
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+} memory_output_t;
+
+/* Sidecar file kept next to an output file in incremental mode, followed by a copy of the program. */
+typedef struct sidecar_header_s {
+    char magic [8];
+    uint32_t sample_rate;
+    uint32_t turbo;
+    uint32_t leader_bits;
+    uint32_t gap_ms;
+    uint32_t pad_ms;
+    uint16_t program_length;
+    char name [17];
+
+    /* Identity of the output file when the sidecar was written, so that
+     * changes made to it by anything else can be detected. */
+    uint64_t wav_device;
+    uint64_t wav_inode;
+    int64_t wav_size;
+    int64_t wav_mtime_sec;
+    int64_t wav_mtime_nsec;
+} sidecar_header_t;
+
+#define SIDECAR_MAGIC "TWSIDE03"
+#define SIDECAR_EXTENSION ".tapewave"
+
+/* Sections reported for each tape in info mode. */
+#define INFO_MAX_SECTIONS 8
+
+/* A single tape to render in batch mode. */
+typedef struct batch_job_s {
+    char *tape_name;
+    char *input_filename;
+    char *output_filename;
+
+    bool success;
+    uint32_t output_file_size;
+    char error [256];
+    char report [256];
+} batch_job_t;
+
+/* Job list shared between the batch mode worker threads. */
+typedef struct batch_s {
+    const encode_settings_t *settings;
+    batch_job_t *jobs;
+    uint32_t job_count;
+    uint32_t next_job;
+    pthread_mutex_t mutex;
+} batch_t;
+
+
+/*
+ * Read a program from 'input_filename' into a newly allocated buffer.
+ * On failure, NULL is returned and a message is written to 'error'.
+ */
+static uint8_t *read_program (const char *input_filename, uint16_t *program_length, char *error, size_t error_size)
+{
+    /* Open the input file and get its length */
+    FILE *input_file = fopen (input_filename, "r");
+    if (input_file == NULL)
+    {
+        snprintf (error, error_size, "Failed to open input file '%s'.", input_filename);
+        return NULL;
+    }
+    fseek (input_file, 0, SEEK_END);
+    uint32_t length = ftell (input_file);
+    fseek (input_file, 0, SEEK_SET);
+
+    /* Check that it will fit in the tape's 16-bit length field */
+    if (length > TAPEWAVE_MAX_PROGRAM_LENGTH)
+    {
+        snprintf (error, error_size, "Error: Program '%s' is too large for a single tape. Use --split <bytes> to write it "
+                  "as several parts.", input_filename);
+        fclose (input_file);
+        return NULL;
+    }
+
+    /* Copy the input file into a buffer */
+    uint8_t *program_buffer = calloc (length + 1, 1);
+    if (program_buffer == NULL)
+    {
+        snprintf (error, error_size, "Failed to allocate memory for input file '%s', size %u.", input_filename, length);
+        fclose (input_file);
+        return NULL;
+    }
+    uint32_t bytes_read = 0;
+    while (bytes_read < length)
+    {
+        size_t result = fread (program_buffer + bytes_read, 1, length - bytes_read, input_file);
+        if (result == 0)
+        {
+            snprintf (error, error_size, "Failed to read input file '%s'.", input_filename);
+            free (program_buffer);
+            fclose (input_file);
+            return NULL;
+        }
+        bytes_read += result;
+    }
 
-/* Note that samples in 8-bit wave files are unsigned. */
-#define WAVE_ZERO       "\xff\xff\xff\xff\x00\x00\x00\x00"
-#define WAVE_ONE        "\xff\xff\x00\x00\xff\xff\x00\x00"
-#define WAVE_SILENT     "\x80"
+    fclose (input_file);
+    *program_length = length;
 
-static FILE *output_file = NULL;
-static int8_t checksum = 0;
+    return program_buffer;
+}
 
 
 /*
- * Write a specified length of silence to the output file.
+ * Check whether a filename ends with an extension, ignoring case.
  */
-static void write_silent_ms (uint32_t length)
+static bool has_extension (const char *filename, const char *extension)
 {
-    /* 9.6 samples per ms. */
-    int samples = length * 96 / 10;
+    const char *filename_extension = strrchr (filename, '.');
+
+    if (filename_extension == NULL || strlen (filename_extension) != strlen (extension))
+    {
+        return false;
+    }
 
-    for (int i = 0; i < samples; i++)
+    for (size_t i = 0; extension [i] != '\0'; i++)
+    {
+        if (tolower (filename_extension [i]) != extension [i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * Fill in a sidecar header for the output file, as it currently exists.
+ */
+static bool sidecar_header_fill (sidecar_header_t *header, const encode_settings_t *settings,
+                                 const char *tape_name, uint16_t program_length, const char *output_filename)
+{
+    struct stat output_stat;
+    if (stat (output_filename, &output_stat) < 0)
     {
-        fwrite (WAVE_SILENT, 1, 1, output_file);
+        return false;
     }
+
+    /* Clear the padding too, so that headers can be compared with memcmp */
+    memset (header, 0, sizeof (sidecar_header_t));
+    memcpy (header->magic, SIDECAR_MAGIC, sizeof (header->magic));
+    header->sample_rate = settings->options.sample_rate;
+    header->turbo = settings->options.turbo;
+    header->leader_bits = settings->options.leader_bits;
+    header->gap_ms = settings->options.gap_ms;
+    header->pad_ms = settings->options.pad_ms;
+    header->program_length = program_length;
+    strncpy (header->name, tape_name, sizeof (header->name) - 1);
+    header->wav_device = output_stat.st_dev;
+    header->wav_inode = output_stat.st_ino;
+    header->wav_size = output_stat.st_size;
+    header->wav_mtime_sec = output_stat.st_mtim.tv_sec;
+    header->wav_mtime_nsec = output_stat.st_mtim.tv_nsec;
+
+    /* A file with other links may be shared, for example by a cache, so must not be patched in place */
+    return output_stat.st_nlink == 1;
 }
 
 
 /*
- * Write a single bit to the wave file.
+ * Read the program last rendered into 'output_filename' from its sidecar.
+ * NULL is returned if there is no sidecar, or if it cannot be used to patch
+ * the output file for a program of 'program_length' bytes with these settings.
  */
-static void write_bit (bool bit)
+static uint8_t *sidecar_read (const encode_settings_t *settings, const char *tape_name,
+                              uint16_t program_length, const char *output_filename, const char *sidecar_filename)
 {
-    /* Note: We have 8 samples per bit */
-    fwrite (bit ? WAVE_ONE : WAVE_ZERO, 1, 8, output_file);
+    sidecar_header_t expected;
+    if (!sidecar_header_fill (&expected, settings, tape_name, program_length, output_filename) ||
+        expected.wav_size != tapewave_wav_size (&settings->options, program_length))
+    {
+        return NULL;
+    }
+
+    FILE *sidecar_file = fopen (sidecar_filename, "r");
+    if (sidecar_file == NULL)
+    {
+        return NULL;
+    }
+
+    sidecar_header_t header;
+    uint8_t *old_program = malloc (program_length + 1);
+    if (old_program == NULL ||
+        fread (&header, sizeof (header), 1, sidecar_file) != 1 ||
+        memcmp (&header, &expected, sizeof (header)) != 0 ||
+        fread (old_program, 1, program_length + 1, sidecar_file) != program_length)
+    {
+        free (old_program);
+        old_program = NULL;
+    }
+
+    fclose (sidecar_file);
+
+    return old_program;
 }
 
 
 /*
- * Write a byte to the wave file.
+ * Record the program now rendered into 'output_filename' in its sidecar.
+ * The sidecar is replaced atomically, so it is never seen half-written.
  */
-static void write_byte (uint8_t byte)
+static bool sidecar_write (const encode_settings_t *settings, const char *tape_name, const uint8_t *program,
+                           uint16_t program_length, const char *output_filename, const char *sidecar_filename)
 {
-    /* Start bit */
-    write_bit (0);
+    sidecar_header_t header;
+    sidecar_header_fill (&header, settings, tape_name, program_length, output_filename);
+
+    size_t temp_filename_size = strlen (sidecar_filename) + 5;
+    char *temp_filename = malloc (temp_filename_size);
+    if (temp_filename == NULL)
+    {
+        return false;
+    }
+    snprintf (temp_filename, temp_filename_size, "%s.tmp", sidecar_filename);
 
-    /* Data bits */
-    for (int i = 0; i < 8; i++)
+    FILE *sidecar_file = fopen (temp_filename, "w");
+    bool success = (sidecar_file != NULL &&
+                    fwrite (&header, sizeof (header), 1, sidecar_file) == 1 &&
+                    fwrite (program, 1, program_length, sidecar_file) == program_length);
+
+    if (sidecar_file != NULL && fclose (sidecar_file) != 0)
+    {
+        success = false;
+    }
+
+    if (success && rename (temp_filename, sidecar_filename) < 0)
+    {
+        success = false;
+    }
+    if (!success)
+    {
+        unlink (temp_filename);
+    }
+
+    free (temp_filename);
+
+    return success;
+}
+
+
+/*
+ * Incremental mode: if the sidecar shows that the output file already holds
+ * a program of the same length, patch only the bytes that have changed.
+ * Returns false if the output file needs a full render instead.
+ */
+static bool encode_file_patch (const encode_settings_t *settings, const char *tape_name, const uint8_t *program,
+                               uint16_t program_length, const char *output_filename, const char *sidecar_filename)
+{
+    uint8_t *old_program = sidecar_read (settings, tape_name, program_length, output_filename, sidecar_filename);
+    if (old_program == NULL)
     {
-        write_bit ((byte >> i) & 1);
+        return false;
     }
 
-    /* Stop bits */
-    write_bit (1);
-    write_bit (1);
+    int output_fd = open (output_filename, O_WRONLY);
+    int result = (output_fd < 0) ? -1 : tapewave_patch (&settings->options, tape_name, old_program,
+                                                          program, program_length, output_fd);
+    free (old_program);
 
-    checksum += byte;
+    if (output_fd >= 0 && close (output_fd) < 0)
+    {
+        result = -1;
+    }
+
+    /* If patching failed part way, the output file no longer matches its sidecar, and the full render replaces it */
+    return result >= 0 && sidecar_write (settings, tape_name, program, program_length, output_filename, sidecar_filename);
 }
 
 
 /*
- * Write the tape to the wave file.
+ * Get the output format from the extension of an output filename.
  */
-static void write_tape (const char *name, uint16_t program_length, uint8_t *program)
+static output_format_t output_format (const char *output_filename)
 {
-    int name_length = strlen (name);
+    if (has_extension (output_filename, ".wav"))
+    {
+        return OUTPUT_WAV;
+    }
+    else if (has_extension (output_filename, ".flac"))
+    {
+        return OUTPUT_FLAC;
+    }
+    else if (has_extension (output_filename, ".tzx"))
+    {
+        return OUTPUT_TZX;
+    }
+
+    return OUTPUT_UNKNOWN;
+}
 
-    /* Write a short silent section. */
-    write_silent_ms (10);
 
-    /* Write the first leader field */
-    for (int i = 0; i < 3600; i++)
+/*
+ * Get the extension used for an output format.
+ */
+static const char *output_extension (output_format_t format)
+{
+    switch (format)
     {
-        write_bit (1);
+        case OUTPUT_FLAC:
+            return ".flac";
+        case OUTPUT_TZX:
+            return ".tzx";
+        default:
+            return ".wav";
     }
+}
 
-    /* Write the header key-code */
-    write_byte (0x16);
-    checksum = 0;
 
-    /* Write the file-name */
-    for (int i = 0; i < 16; i++)
+/*
+ * Check that a program fits in memory alongside the loader, on a turbo tape.
+ * On failure, false is returned and a message is written to 'error'.
+ */
+static bool turbo_length_check (const encode_settings_t *settings, uint16_t program_length,
+                                char *error, size_t error_size)
+{
+    if (settings->options.turbo != 0 && program_length > TAPEWAVE_TURBO_MAX_PROGRAM_LENGTH)
     {
-        write_byte ((i < name_length) ? name [i] : ' ');
+        snprintf (error, error_size, "Error: Programs on turbo tapes are limited to %u bytes.",
+                  TAPEWAVE_TURBO_MAX_PROGRAM_LENGTH);
+        return false;
     }
 
-    /* Write the program length */
-    /* TODO: Confirm byte order - In the scanned document, pencil and ink disagree. */
-    write_byte (program_length >> 8);
-    write_byte (program_length & 0xff);
+    return true;
+}
+
+
+/*
+ * Set the timing to a named profile. Returns false if there is no such profile.
+ */
+static bool timing_profile (tapewave_options_t *options, const char *profile)
+{
+    if (strcmp (profile, "standard") == 0)
+    {
+        options->leader_bits = TAPEWAVE_STANDARD_LEADER_BITS;
+        options->gap_ms = TAPEWAVE_STANDARD_GAP_MS;
+        options->pad_ms = TAPEWAVE_STANDARD_PAD_MS;
+    }
+    else if (strcmp (profile, "minimal") == 0)
+    {
+        options->leader_bits = TAPEWAVE_MINIMAL_LEADER_BITS;
+        options->gap_ms = TAPEWAVE_MINIMAL_GAP_MS;
+        options->pad_ms = TAPEWAVE_MINIMAL_PAD_MS;
+    }
+    else
+    {
+        return false;
+    }
 
-    /* Write the parity byte */
-    write_byte (-checksum);
+    return true;
+}
 
-    /* Write two bytes of dummy data */
-    write_byte (0x00);
-    write_byte (0x00);
 
-    /* One second of silence */
-    write_silent_ms (1000);
+/*
+ * Get the play time of a tape, in seconds. Returns a negative time if the
+ * program cannot be put on the tape.
+ */
+static double tape_seconds (const tapewave_options_t *options, uint16_t program_length)
+{
+    tapewave_section_t sections [INFO_MAX_SECTIONS];
+    int section_count = tapewave_tape_layout (options, program_length, sections, INFO_MAX_SECTIONS);
 
-    /* Write the second leader field */
-    for (int i = 0; i < 3600; i++)
+    if (section_count <= 0)
     {
-        write_bit (1);
+        return -1.0;
     }
 
-    /* Write the program key-code */
-    write_byte (0x17);
-    checksum = 0;
+    const tapewave_section_t *last = &sections [section_count - 1];
+    return (double) (last->start + last->samples) / options->sample_rate;
+}
+
 
-    /* Write the program */
-    for (int i = 0; i < program_length; i++)
+/*
+ * Compress a program behind a depacker, if it is then quicker to load, counting
+ * the time taken to unpack it as well as the time on tape. Returns the compressed
+ * copy, or NULL if the program is to be kept as it is. The outcome is described
+ * in 'report'.
+ */
+static uint8_t *compress_program (const encode_settings_t *settings, const uint8_t *program, uint16_t program_length,
+                                  uint16_t *packed_length, char *report, size_t report_size)
+{
+    double depack_time = 0.0;
+    uint8_t *packed = pack_program (program, program_length, packed_length, &depack_time);
+    if (packed == NULL)
     {
-        write_byte (program [i]);
+        snprintf (report, report_size, "Not compressed: %s.",
+                  (errno == EFBIG) ? "too large to unpack in memory" : strerror (errno));
+        return NULL;
     }
 
-    /* Write the parity byte */
-    write_byte (-checksum);
+    double tape_time = tape_seconds (&settings->options, program_length);
+    double packed_tape_time = tape_seconds (&settings->options, *packed_length);
 
-    /* Write two bytes of dummy data */
-    write_byte (0x00);
-    write_byte (0x00);
+    /* A program too large for a turbo tape may still fit once compressed */
+    if (packed_tape_time >= 0.0 && (tape_time < 0.0 || packed_tape_time + depack_time < tape_time))
+    {
+        snprintf (report, report_size, "Compressed from %u to %u bytes: %.1f s on tape instead of %.1f s, "
+                  "then %.2f s to unpack.", program_length, *packed_length, packed_tape_time, tape_time, depack_time);
+        return packed;
+    }
 
-    /* Write a short silent section. */
-    write_silent_ms (10);
+    snprintf (report, report_size, "Not compressed: %u bytes compress to %u, taking %.1f s on tape and %.2f s to "
+              "unpack, against %.1f s.", program_length, *packed_length, packed_tape_time, depack_time, tape_time);
+    free (packed);
+    return NULL;
 }
 
 
 /*
- * Entry point.
+ * Append the difference between the play time of a tape, and its play time with
+ * the standard timing, to 'report'. Nothing is added if they are the same.
+ */
+static void timing_append (double tape_time, double standard_time, char *report, size_t report_size)
+{
+    size_t length = strlen (report);
+
+    if (tape_time < 0.0 || standard_time < 0.0 || tape_time == standard_time || length >= report_size)
+    {
+        return;
+    }
+
+    bool shorter = (tape_time < standard_time);
+    snprintf (report + length, report_size - length, "%sTiming: %.1f s on tape, %.1f s %s than the standard %.1f s.",
+              (length == 0) ? "" : " ", tape_time, shorter ? standard_time - tape_time : tape_time - standard_time,
+              shorter ? "less" : "more", standard_time);
+}
+
+
+/*
+ * With a timing other than the standard, append the time that it saves on the
+ * tape of a program to 'report'.
+ */
+static void timing_report (const encode_settings_t *settings, uint16_t program_length, char *report, size_t report_size)
+{
+    tapewave_options_t standard = settings->options;
+    timing_profile (&standard, "standard");
+
+    timing_append (tape_seconds (&settings->options, program_length), tape_seconds (&standard, program_length),
+                   report, report_size);
+}
+
+
+/*
+ * Render a program into a file at 'output_filename', in the format given by its
+ * extension. An output filename of '-' streams a wave file to stdout. If a cache
+ * is in use, a file already rendered for the same program is reused instead.
  *
- * Note that we assume a little-endian host.
+ * The encoder's buffer is kept between calls, so it can be reused for each tape.
+ * On failure, false is returned and a message is written to 'error'.
  */
-int main (int argc, char **argv)
+static bool encode_program (tapewave_encoder_t *encoder, const encode_settings_t *settings, const char *tape_name,
+                            const uint8_t *program, uint16_t program_length, const char *output_filename,
+                            uint32_t *output_file_size, char *error, size_t error_size)
 {
-    const uint32_t format_length            = 16;       /* Length of the format section in bytes */
-    const uint16_t format_type              = 1;        /* PCM */
-    const uint16_t format_channels          = 1;        /* Mono */
-    const uint32_t format_sample_rate       = 9600;    /* 9.6 kHz, giving 8 samples per tape-bit */
-    const uint32_t format_byte_rate         = 9600;    /* One byte per frame */
-    const uint16_t format_block_align       = 1;        /* Frames are one-byte aligned */
-    const uint16_t format_bits_per_sample   = 8;        /* 8-bit */
+    bool output_stream = (strcmp (output_filename, "-") == 0);
+    output_format_t format = output_stream ? OUTPUT_WAV : output_format (output_filename);
 
-    /* 'riff_size' and 'data_size' store the number of bytes still to come,
-     * counting from the first byte that comes after the size field itself. */
-    uint32_t output_file_size = 0;
-    uint32_t riff_size = 0;
-    uint32_t data_size = 0;
+    if (output_stream)
+    {
+        output_filename = "stdout";
+    }
+    else if (format == OUTPUT_UNKNOWN)
+    {
+        snprintf (error, error_size, "Output file must have '.wav', '.flac', or '.tzx' extension.");
+        return false;
+    }
 
-    fpos_t riff_size_pos;
-    fpos_t data_size_pos;
+    if (!turbo_length_check (settings, program_length, error, error_size))
+    {
+        return false;
+    }
 
-    const char *argv_0 = argv [0];
+    char *sidecar_filename = NULL;
+    if (settings->incremental && !output_stream && format == OUTPUT_WAV)
+    {
+        size_t sidecar_filename_size = strlen (output_filename) + strlen (SIDECAR_EXTENSION) + 1;
+        sidecar_filename = malloc (sidecar_filename_size);
+        if (sidecar_filename == NULL)
+        {
+            snprintf (error, error_size, "Failed to allocate memory for sidecar filename.");
+            return false;
+        }
+        snprintf (sidecar_filename, sidecar_filename_size, "%s%s", output_filename, SIDECAR_EXTENSION);
+    }
 
-    /* Check parameters */
-    if (argc != 4)
+    /* With a cache, a file previously rendered with the same parameters is placed at the output */
+    bool use_cache = settings->cache.directory != NULL && !output_stream;
+    cache_key_t cache_key;
+    if (use_cache)
     {
-        fprintf (stderr, "Usage: %s <name-on-tape> <input-file> <output-file.wav>\n", argv_0);
-        return EXIT_FAILURE;
+        cache_key_init (&cache_key, output_extension (format), &settings->options, tape_name,
+                        program, program_length);
+
+        struct stat output_stat;
+        if (cache_fetch (&settings->cache, &cache_key, output_filename) && stat (output_filename, &output_stat) == 0)
+        {
+            if (sidecar_filename != NULL)
+            {
+                sidecar_write (settings, tape_name, program, program_length, output_filename, sidecar_filename);
+            }
+
+            *output_file_size = output_stat.st_size;
+            free (sidecar_filename);
+            return true;
+        }
     }
 
-    const char *tape_name =       argv [1];
-    const char *input_filename =  argv [2];
-    const char *output_filename = argv [3];
+    /* In incremental mode, try patching the existing output file before rendering it from scratch.
+     * Only wave files are patched in place, as the other formats are variable-length. */
+    if (sidecar_filename != NULL &&
+        encode_file_patch (settings, tape_name, program, program_length, output_filename, sidecar_filename))
+    {
+        *output_file_size = tapewave_wav_size (&settings->options, program_length);
+        free (sidecar_filename);
+        if (use_cache)
+        {
+            cache_store (&settings->cache, &cache_key, output_filename);
+        }
+        return true;
+    }
 
-    /* Check for the .wav extension in the output filename */
-    const char *output_extension = strrchr (output_filename, '.');
-    if (output_extension == NULL || strlen(output_extension) != 4 ||
-        tolower (output_extension [1]) != 'w' ||
-        tolower (output_extension [2]) != 'a' ||
-        tolower (output_extension [3]) != 'v')
+    /* Render a shared output file, such as one linked from the cache, as a new file, leaving its other links untouched */
+    struct stat output_stat;
+    if (!output_stream && stat (output_filename, &output_stat) == 0 && output_stat.st_nlink > 1)
     {
-        fprintf (stderr, "Output file must have '.wav' extension.\n");
-        return EXIT_FAILURE;
+        unlink (output_filename);
     }
 
-    /* Open the input file and get its length */
-    FILE *input_file = fopen (input_filename, "r");
-    if (input_file == NULL)
+    /* Open the output file. A memory-mapping needs read access as well as write access. */
+    bool use_mmap = settings->use_mmap && !output_stream && format == OUTPUT_WAV;
+    int output_fd = output_stream ? STDOUT_FILENO : open (output_filename, (use_mmap ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (output_fd < 0)
     {
-        fprintf (stderr, "Failed to open input file '%s'.\n", input_filename);
-        return EXIT_FAILURE;
+        snprintf (error, error_size, "Failed to open output file '%s'.", output_filename);
+        free (sidecar_filename);
+        return false;
     }
-    fseek (input_file, 0, SEEK_END);
-    uint32_t program_length = ftell (input_file);
-    fseek (input_file, 0, SEEK_SET);
 
-    /* Check that it will fit in the tape's 16-bit length field */
-    if (program_length > 65535)
+    int result;
+    if (format == OUTPUT_FLAC)
     {
-        fprintf (stderr, "Error: Program '%s' is too large.\n", input_filename);
-        return EXIT_FAILURE;
+        result = tapewave_encode_flac (encoder, &settings->options, tape_name, program, program_length, output_fd);
+    }
+    else if (format == OUTPUT_TZX)
+    {
+        result = tapewave_encode_tzx (encoder, &settings->options, tape_name, program, program_length, output_fd);
+    }
+    else if (use_mmap)
+    {
+        result = tapewave_encode_to_mmap (&settings->options, tape_name, program, program_length, output_fd);
+    }
+    else
+    {
+        result = tapewave_encode (encoder, &settings->options, tape_name, program, program_length,
+                                  output_fd, output_stream);
     }
+    int encode_errno = errno;
+    off_t output_end = lseek (output_fd, 0, SEEK_CUR);
 
-    /* Copy the input file into a buffer */
-    uint8_t *program_buffer = calloc (program_length, 1);
+    if (close (output_fd) < 0 || result < 0)
+    {
+        if (result < 0)
+        {
+            errno = encode_errno;
+        }
+
+        snprintf (error, error_size, "Failed to write output file '%s': %s.", output_filename, strerror (errno));
+        free (sidecar_filename);
+        return false;
+    }
+
+    if (sidecar_filename != NULL &&
+        !sidecar_write (settings, tape_name, program, program_length, output_filename, sidecar_filename))
+    {
+        snprintf (error, error_size, "Failed to write sidecar file '%s'.", sidecar_filename);
+        free (sidecar_filename);
+        return false;
+    }
+
+    free (sidecar_filename);
+    *output_file_size = (format == OUTPUT_WAV) ? tapewave_wav_size (&settings->options, program_length) : output_end;
+
+    /* The cache is only an optimisation, so failing to store the file is not an error */
+    if (use_cache)
+    {
+        cache_store (&settings->cache, &cache_key, output_filename);
+    }
+
+    return true;
+}
+
+
+/*
+ * Render a program from 'input_filename' into a file at 'output_filename'.
+ * With --compress, the outcome of compressing it is written to 'report', along
+ * with the time saved by a non-standard timing.
+ * On failure, false is returned and a message is written to 'error'.
+ */
+static bool encode_file (tapewave_encoder_t *encoder, const encode_settings_t *settings,
+                         const char *tape_name, const char *input_filename, const char *output_filename,
+                         uint32_t *output_file_size, char *report, size_t report_size, char *error, size_t error_size)
+{
+    uint16_t program_length = 0;
+    uint8_t *program_buffer = read_program (input_filename, &program_length, error, error_size);
     if (program_buffer == NULL)
     {
-        fprintf (stderr, "Failed to allocate memory for input file '%s', size .\n", input_filename);
+        return false;
+    }
+
+    uint16_t packed_length;
+    uint8_t *packed = settings->compress ? compress_program (settings, program_buffer, program_length,
+                                                             &packed_length, report, report_size) : NULL;
+    if (packed != NULL)
+    {
+        free (program_buffer);
+        program_buffer = packed;
+        program_length = packed_length;
+    }
+
+    if (report != NULL)
+    {
+        timing_report (settings, program_length, report, report_size);
+    }
+
+    bool success = encode_program (encoder, settings, tape_name, program_buffer, program_length, output_filename,
+                                   output_file_size, error, error_size);
+    free (program_buffer);
+
+    return success;
+}
+
+
+/*
+ * Batch mode worker thread. Takes jobs from the shared list until none remain.
+ */
+static void *batch_worker (void *arg)
+{
+    batch_t *batch = arg;
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+
+    while (true)
+    {
+        pthread_mutex_lock (&batch->mutex);
+        uint32_t index = batch->next_job++;
+        pthread_mutex_unlock (&batch->mutex);
+
+        if (index >= batch->job_count)
+        {
+            break;
+        }
+
+        batch_job_t *job = &batch->jobs [index];
+
+        if (strcmp (job->output_filename, "-") == 0)
+        {
+            snprintf (job->error, sizeof (job->error), "Output to stdout is not supported in batch mode.");
+            continue;
+        }
+
+        job->success = encode_file (&encoder, batch->settings, job->tape_name, job->input_filename,
+                                    job->output_filename, &job->output_file_size, job->report, sizeof (job->report),
+                                    job->error, sizeof (job->error));
+    }
+
+    tapewave_encoder_free (&encoder);
+
+    return NULL;
+}
+
+
+/*
+ * Read a batch manifest. Each line holds a tab-separated triple of
+ * <name-on-tape> <input-file> <output-file.wav>. Empty lines and
+ * lines starting with '#' are ignored.
+ */
+static bool batch_read_manifest (batch_t *batch, const char *manifest_filename)
+{
+    bool manifest_stdin = (strcmp (manifest_filename, "-") == 0);
+    FILE *manifest_file = manifest_stdin ? stdin : fopen (manifest_filename, "r");
+    if (manifest_file == NULL)
+    {
+        fprintf (stderr, "Failed to open manifest file '%s'.\n", manifest_filename);
+        return false;
+    }
+
+    uint32_t jobs_size = 0;
+    uint32_t line_number = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+    bool success = true;
+
+    while ((line_length = getline (&line, &line_size, manifest_file)) >= 0)
+    {
+        line_number++;
+
+        /* Strip the line ending */
+        while (line_length > 0 && (line [line_length - 1] == '\n' || line [line_length - 1] == '\r'))
+        {
+            line [--line_length] = '\0';
+        }
+
+        if (line_length == 0 || line [0] == '#')
+        {
+            continue;
+        }
+
+        char *tape_name = line;
+        char *input_filename = strchr (tape_name, '\t');
+        char *output_filename = (input_filename == NULL) ? NULL : strchr (input_filename + 1, '\t');
+        if (output_filename == NULL || strchr (output_filename + 1, '\t') != NULL)
+        {
+            fprintf (stderr, "%s:%u: Expected <name-on-tape> <input-file> <output-file.wav>, separated by tabs.\n",
+                     manifest_filename, line_number);
+            success = false;
+            break;
+        }
+        *input_filename++ = '\0';
+        *output_filename++ = '\0';
+
+        if (batch->job_count == jobs_size)
+        {
+            jobs_size = (jobs_size == 0) ? 64 : jobs_size * 2;
+            batch_job_t *jobs = realloc (batch->jobs, jobs_size * sizeof (batch_job_t));
+            if (jobs == NULL)
+            {
+                fprintf (stderr, "Failed to allocate memory for batch jobs.\n");
+                success = false;
+                break;
+            }
+            batch->jobs = jobs;
+        }
+
+        batch_job_t *job = &batch->jobs [batch->job_count++];
+        memset (job, 0, sizeof (batch_job_t));
+        job->tape_name = strdup (tape_name);
+        job->input_filename = strdup (input_filename);
+        job->output_filename = strdup (output_filename);
+    }
+
+    free (line);
+    if (!manifest_stdin)
+    {
+        fclose (manifest_file);
+    }
+
+    return success;
+}
+
+
+/*
+ * Render every tape listed in a manifest, using a pool of worker threads.
+ */
+static int batch_main (const encode_settings_t *settings, const char *manifest_filename, uint32_t thread_count)
+{
+    batch_t batch = { .settings = settings };
+    pthread_mutex_init (&batch.mutex, NULL);
+
+    if (!batch_read_manifest (&batch, manifest_filename))
+    {
         return EXIT_FAILURE;
     }
-    uint32_t bytes_read = 0;
-    while (bytes_read < program_length)
+
+    if (thread_count > batch.job_count)
     {
-        bytes_read += fread (program_buffer + bytes_read, 1, program_length - bytes_read, input_file);
+        thread_count = batch.job_count;
     }
 
-    /* Open the output file */
-    output_file = fopen (output_filename, "w");
-    if (output_file == NULL)
+    struct timespec start_time;
+    struct timespec end_time;
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
+
+    pthread_t *threads = calloc (thread_count, sizeof (pthread_t));
+    if (thread_count > 0 && threads == NULL)
     {
-        fprintf (stderr, "Failed to open output file '%s'.\n", output_filename);
+        fprintf (stderr, "Failed to allocate memory for worker threads.\n");
         return EXIT_FAILURE;
     }
 
-    /* Write RIFF header */
-    fwrite ("RIFF", 1, 4, output_file);
-    fgetpos (output_file, &riff_size_pos);
-    fwrite (&riff_size, 1, 4, output_file);
-    fwrite ("WAVE", 1, 4, output_file);
-
-    /* Write WAVE format */
-    fwrite ("fmt ", 1, 4, output_file);
-    fwrite (&format_length, 1, 4, output_file);
-    fwrite (&format_type, 1, 2, output_file);
-    fwrite (&format_channels, 1, 2, output_file);
-    fwrite (&format_sample_rate, 1, 4, output_file);
-    fwrite (&format_byte_rate, 1, 4, output_file);
-    fwrite (&format_block_align, 1, 2, output_file);
-    fwrite (&format_bits_per_sample, 1, 2, output_file);
-
-    /* Write WAVE data */
-    fwrite ("data", 1, 4, output_file);
-    fgetpos (output_file, &data_size_pos);
-    fwrite (&data_size, 1, 4, output_file);
-    write_tape (tape_name, program_length, program_buffer);
-
-    /* Get size */
-    output_file_size = ftell (output_file);
-    riff_size = output_file_size - 8;
-    data_size = output_file_size - 44;
-
-    /* Populate size fields in wave file */
-    fsetpos (output_file, &riff_size_pos);
-    fwrite (&riff_size, 1, 4, output_file);
-    fsetpos (output_file, &data_size_pos);
-    fwrite (&data_size, 1, 4, output_file);
-
-    fclose (output_file);
+    /* If a thread cannot be started, the remaining threads pick up its share */
+    uint32_t threads_started = 0;
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        if (pthread_create (&threads [threads_started], NULL, batch_worker, &batch) == 0)
+        {
+            threads_started++;
+        }
+    }
+    if (threads_started == 0)
+    {
+        batch_worker (&batch);
+    }
+
+    for (uint32_t i = 0; i < threads_started; i++)
+    {
+        pthread_join (threads [i], NULL);
+    }
 
-    return EXIT_SUCCESS;
+    clock_gettime (CLOCK_MONOTONIC, &end_time);
+    double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+
+    /* Report per-job status */
+    uint32_t failed_count = 0;
+    uint64_t bytes_written = 0;
+    for (uint32_t i = 0; i < batch.job_count; i++)
+    {
+        batch_job_t *job = &batch.jobs [i];
+
+        if (job->success)
+        {
+            printf ("ok      %s (%u bytes)\n", job->output_filename, job->output_file_size);
+            if (job->report [0] != '\0')
+            {
+                printf ("        %s\n", job->report);
+            }
+            bytes_written += job->output_file_size;
+        }
+        else
+        {
+            printf ("FAILED  %s: %s\n", job->output_filename, job->error);
+            failed_count++;
+        }
+
+        free (job->tape_name);
+        free (job->input_filename);
+        free (job->output_filename);
+    }
+
+    /* Report total throughput */
+    printf ("%u tapes, %u failed, %.1f MB written in %.3f s (%.1f tapes/s, %.1f MB/s) using %u threads.\n",
+            batch.job_count, failed_count, bytes_written / 1e6, seconds,
+            (seconds > 0) ? batch.job_count / seconds : 0.0,
+            (seconds > 0) ? bytes_written / 1e6 / seconds : 0.0,
+            threads_started);
+
+    free (threads);
+    free (batch.jobs);
+    pthread_mutex_destroy (&batch.mutex);
+
+    return (failed_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Print the index of a tape holding several programs: the time at which each
+ * program's tape starts, to seek to it by.
+ */
+static void multi_print_index (FILE *index_file, const tapewave_entry_t *entries, const uint64_t *starts,
+                               uint32_t entry_count, uint32_t sample_rate)
+{
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        double seconds = (double) starts [i] / sample_rate;
+        uint32_t minutes = seconds / 60;
+
+        fprintf (index_file, "%3u  %3u:%06.3f  %8.3f s  %5u bytes  %s\n", i + 1, minutes, seconds - minutes * 60.0,
+                 seconds, entries [i].program_length, entries [i].name);
+    }
+}
+
+
+/*
+ * Render a list of programs, one after another, into a single wave file. The
+ * file is streamed in one pass, and once it is written, an index of the
+ * programs is printed. On failure, false is returned and a message is written
+ * to 'error'.
+ */
+static bool write_list (const encode_settings_t *settings, const char *output_filename,
+                        const tapewave_entry_t *entries, uint32_t entry_count, char *error, size_t error_size)
+{
+    bool output_stream = (strcmp (output_filename, "-") == 0);
+    if (!output_stream && output_format (output_filename) != OUTPUT_WAV)
+    {
+        snprintf (error, error_size, "With several programs, the output file must have '.wav' extension.");
+        return false;
+    }
+
+    /* Each program's position is known before any of them are rendered */
+    uint64_t *starts = calloc (entry_count, sizeof (uint64_t));
+    if (starts == NULL)
+    {
+        snprintf (error, error_size, "Failed to allocate memory for the index of %u programs.", entry_count);
+        return false;
+    }
+    uint64_t samples = tapewave_list_layout (&settings->options, entries, entry_count, starts);
+    if (samples == 0)
+    {
+        snprintf (error, error_size, "Failed to lay out tape: %s.", strerror (errno));
+        free (starts);
+        return false;
+    }
+
+    int output_fd = output_stream ? STDOUT_FILENO : open (output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_fd < 0)
+    {
+        snprintf (error, error_size, "Failed to open output file '%s'.", output_filename);
+        free (starts);
+        return false;
+    }
+
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+    int result = tapewave_encode_list (&encoder, &settings->options, entries, entry_count, output_fd);
+    int encode_errno = errno;
+    tapewave_encoder_free (&encoder);
+
+    if (close (output_fd) < 0 || result < 0)
+    {
+        if (result < 0)
+        {
+            errno = encode_errno;
+        }
+        snprintf (error, error_size, "Failed to write output file '%s': %s.",
+                  output_stream ? "stdout" : output_filename, strerror (errno));
+        free (starts);
+        return false;
+    }
+
+    /* The index is printed on stderr, if stdout is carrying the wave file */
+    FILE *report_file = output_stream ? stderr : stdout;
+    multi_print_index (report_file, entries, starts, entry_count, settings->options.sample_rate);
+
+    tapewave_options_t standard = settings->options;
+    timing_profile (&standard, "standard");
+    char report [256] = "";
+    timing_append ((double) samples / settings->options.sample_rate,
+                   (double) tapewave_list_layout (&standard, entries, entry_count, NULL) / standard.sample_rate,
+                   report, sizeof (report));
+    if (report [0] != '\0')
+    {
+        fprintf (report_file, "%s\n", report);
+    }
+
+    free (starts);
+    return true;
+}
+
+
+/*
+ * Render several programs, given as pairs of <name-on-tape> <input-file>
+ * arguments, one after another into a single wave file.
+ */
+static int multi_main (const encode_settings_t *settings, const char *output_filename,
+                       const char **arguments, uint32_t entry_count)
+{
+    tapewave_entry_t *entries = calloc (entry_count, sizeof (tapewave_entry_t));
+    if (entries == NULL)
+    {
+        fprintf (stderr, "Failed to allocate memory for %u programs.\n", entry_count);
+        return EXIT_FAILURE;
+    }
+
+    bool success = true;
+    char error [256];
+    for (uint32_t i = 0; i < entry_count && success; i++)
+    {
+        tapewave_entry_t *entry = &entries [i];
+        const char *input_filename = arguments [2 * i + 1];
+        uint16_t program_length = 0;
+        uint8_t *program = read_program (input_filename, &program_length, error, sizeof (error));
+
+        char report [256] = "";
+        uint16_t packed_length;
+        uint8_t *packed = (program != NULL && settings->compress) ?
+                          compress_program (settings, program, program_length, &packed_length, report, sizeof (report)) : NULL;
+        if (packed != NULL)
+        {
+            free (program);
+            program = packed;
+            program_length = packed_length;
+        }
+        if (report [0] != '\0')
+        {
+            fprintf (stderr, "%s: %s\n", input_filename, report);
+        }
+
+        entry->name = arguments [2 * i];
+        entry->program = program;
+        entry->program_length = program_length;
+
+        success = (program != NULL) && turbo_length_check (settings, program_length, error, sizeof (error));
+    }
+
+    if (success)
+    {
+        success = write_list (settings, output_filename, entries, entry_count, error, sizeof (error));
+    }
+    if (!success)
+    {
+        fprintf (stderr, "%s\n", error);
+    }
+
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        free ((uint8_t *) entries [i].program);
+    }
+    free (entries);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Build the name of part 'part' of a split program, such as 'NAME.1', cutting
+ * the name short where needed for the suffix to fit in the header's 16 characters.
+ */
+static void split_part_name (char *part_name, const char *tape_name, uint32_t part)
+{
+    char suffix [12];
+    int suffix_length = snprintf (suffix, sizeof (suffix), ".%u", part);
+    int name_length = strlen (tape_name);
+
+    if (name_length > 16 - suffix_length)
+    {
+        name_length = 16 - suffix_length;
+    }
+
+    snprintf (part_name, 17, "%.*s%s", name_length, tape_name, suffix);
+}
+
+
+/*
+ * Build the filename for part 'part' of a split program, by numbering the
+ * output filename before its extension, such as 'out.1.wav'. Returns a newly
+ * allocated string, or NULL.
+ */
+static char *split_part_filename (const char *output_filename, uint32_t part)
+{
+    const char *extension = strrchr (output_filename, '.');
+    const char *slash = strrchr (output_filename, '/');
+    if (extension == NULL || (slash != NULL && extension < slash))
+    {
+        extension = output_filename + strlen (output_filename);
+    }
+
+    size_t filename_size = strlen (output_filename) + 12;
+    char *filename = malloc (filename_size);
+    if (filename != NULL)
+    {
+        snprintf (filename, filename_size, "%.*s.%u%s", (int) (extension - output_filename), output_filename,
+                  part, extension);
+    }
+
+    return filename;
+}
+
+
+/*
+ * Split a file too large for a single tape into numbered parts of at most
+ * 'part_size' bytes, named NAME.1, NAME.2, and so on. The parts are rendered
+ * one after another into a single wave file, or with 'separate', each into a
+ * file of its own. The input is memory-mapped rather than read, so its pages
+ * are only brought in as they are rendered, and are not held onto.
+ */
+static int split_main (const encode_settings_t *settings, const char *tape_name, const char *input_filename,
+                       const char *output_filename, uint32_t part_size, bool separate)
+{
+    int input_fd = open (input_filename, O_RDONLY);
+    struct stat input_stat;
+    if (input_fd < 0 || fstat (input_fd, &input_stat) < 0 || !S_ISREG (input_stat.st_mode))
+    {
+        fprintf (stderr, "Failed to open input file '%s'.\n", input_filename);
+        if (input_fd >= 0)
+        {
+            close (input_fd);
+        }
+        return EXIT_FAILURE;
+    }
+
+    /* An empty file is a single, empty, part. A program of NULL would only be laid out, not rendered. */
+    static const uint8_t empty_program [1] = { 0 };
+    size_t input_size = input_stat.st_size;
+    uint8_t *input = (input_size == 0) ? NULL : mmap (NULL, input_size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close (input_fd);
+    if (input == MAP_FAILED)
+    {
+        fprintf (stderr, "Failed to map input file '%s'.\n", input_filename);
+        return EXIT_FAILURE;
+    }
+    if (input != NULL)
+    {
+        posix_madvise (input, input_size, POSIX_MADV_SEQUENTIAL);
+    }
+
+    uint64_t part_count = (input_size == 0) ? 1 : (input_size + part_size - 1) / part_size;
+    if (part_count > UINT32_MAX)
+    {
+        fprintf (stderr, "Input file '%s' is too large to split into parts of %u bytes.\n", input_filename, part_size);
+        munmap (input, input_size);
+        return EXIT_FAILURE;
+    }
+
+    tapewave_entry_t *entries = calloc (part_count, sizeof (tapewave_entry_t));
+    char (*part_names) [17] = calloc (part_count, sizeof (*part_names));
+    if (entries == NULL || part_names == NULL)
+    {
+        fprintf (stderr, "Failed to allocate memory for %" PRIu64 " parts.\n", part_count);
+        free (entries);
+        free (part_names);
+        if (input != NULL)
+        {
+            munmap (input, input_size);
+        }
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < part_count; i++)
+    {
+        size_t offset = (size_t) i * part_size;
+
+        split_part_name (part_names [i], tape_name, i + 1);
+        entries [i].name = part_names [i];
+        entries [i].program = (input != NULL) ? input + offset : empty_program;
+        entries [i].program_length = (input_size - offset < part_size) ? input_size - offset : part_size;
+    }
+
+    bool success = true;
+    char error [256];
+    if (separate)
+    {
+        tapewave_encoder_t encoder;
+        tapewave_encoder_init (&encoder);
+
+        for (uint32_t i = 0; i < part_count && success; i++)
+        {
+            char *part_filename = split_part_filename (output_filename, i + 1);
+            uint32_t output_file_size = 0;
+
+            if (part_filename == NULL)
+            {
+                snprintf (error, sizeof (error), "Failed to allocate memory for output filename.");
+                success = false;
+            }
+            else if ((success = encode_program (&encoder, settings, entries [i].name, entries [i].program,
+                                                entries [i].program_length, part_filename, &output_file_size,
+                                                error, sizeof (error))))
+            {
+                printf ("%-16s  %5u bytes  %s\n", entries [i].name, entries [i].program_length, part_filename);
+            }
+
+            free (part_filename);
+        }
+
+        tapewave_encoder_free (&encoder);
+    }
+    else
+    {
+        success = write_list (settings, output_filename, entries, part_count, error, sizeof (error));
+    }
+
+    if (!success)
+    {
+        fprintf (stderr, "%s\n", error);
+    }
+
+    free (entries);
+    free (part_names);
+    if (input != NULL)
+    {
+        munmap (input, input_size);
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Sink that collects rendered data into a growable memory buffer.
+ */
+static int memory_sink (void *context, const uint8_t *data, size_t length)
+{
+    memory_output_t *output = context;
+
+    if (output->used + length > output->size)
+    {
+        size_t size = (output->size == 0) ? TAPEWAVE_STREAM_BUFFER_SIZE : output->size;
+        while (size < output->used + length)
+        {
+            size *= 2;
+        }
+
+        uint8_t *buffer = realloc (output->buffer, size);
+        if (buffer == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        output->buffer = buffer;
+        output->size = size;
+    }
+
+    memcpy (output->buffer + output->used, data, length);
+    output->used += length;
+
+    return 0;
+}
+
+
+/*
+ * Render a program into memory, in the given format.
+ * On failure, false is returned and a message is written to 'error'.
+ */
+static bool encode_memory (tapewave_encoder_t *encoder, const encode_settings_t *settings, output_format_t format,
+                           const char *tape_name, const uint8_t *program, uint16_t program_length,
+                           memory_output_t *output, char *error, size_t error_size)
+{
+    int result;
+    output->used = 0;
+
+    if (!turbo_length_check (settings, program_length, error, error_size))
+    {
+        return false;
+    }
+
+    if (format == OUTPUT_FLAC)
+    {
+        result = tapewave_encode_flac_to_sink (encoder, &settings->options, tape_name, program, program_length,
+                                               memory_sink, output);
+    }
+    else if (format == OUTPUT_TZX)
+    {
+        result = tapewave_encode_tzx_to_sink (encoder, &settings->options, tape_name, program, program_length,
+                                              memory_sink, output);
+    }
+    else
+    {
+        /* The size of a wave file is known, so it is rendered straight into the buffer */
+        uint32_t wav_size = tapewave_wav_size (&settings->options, program_length);
+        result = 0;
+        if (wav_size > output->size)
+        {
+            uint8_t *buffer = realloc (output->buffer, wav_size);
+            if (buffer == NULL)
+            {
+                errno = ENOMEM;
+                result = -1;
+            }
+            else
+            {
+                output->buffer = buffer;
+                output->size = wav_size;
+            }
+        }
+        if (result == 0)
+        {
+            result = tapewave_encode_to_buffer (&settings->options, tape_name, program, program_length,
+                                                output->buffer, output->size);
+            output->used = wav_size;
+        }
+    }
+
+    if (result < 0)
+    {
+        snprintf (error, error_size, "Failed to render tape: %s.", strerror (errno));
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Worker mode: render a series of requests read from stdin, answering each on
+ * stdout. The encoder, buffers, and waveform tables are kept between requests.
+ *
+ * Each request is a line holding a tab-separated <name-on-tape> <input> <output>.
+ * An input of '@<length>' means that <length> bytes of program follow the line.
+ * An output of '-', '-.wav', '-.flac', or '-.tzx' returns the rendered file.
+ *
+ * Each request is answered with 'ok <bytes>', followed by the rendered file if
+ * it is being returned, or with 'error <message>'.
+ */
+static int worker_main (const encode_settings_t *settings)
+{
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+    memory_output_t output = { .buffer = NULL };
+    uint8_t *inline_program = malloc (TAPEWAVE_MAX_PROGRAM_LENGTH + 1);
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+    int status = EXIT_SUCCESS;
+
+    if (inline_program == NULL)
+    {
+        fprintf (stderr, "Failed to allocate memory for programs.\n");
+        return EXIT_FAILURE;
+    }
+
+    while ((line_length = getline (&line, &line_size, stdin)) >= 0)
+    {
+        char error [256] = "";
+        uint8_t *program = NULL;
+        uint16_t program_length = 0;
+        uint32_t output_file_size = 0;
+        bool returned = false;
+
+        /* Strip the line ending */
+        while (line_length > 0 && (line [line_length - 1] == '\n' || line [line_length - 1] == '\r'))
+        {
+            line [--line_length] = '\0';
+        }
+
+        char *tape_name = line;
+        char *input = strchr (tape_name, '\t');
+        char *output_filename = (input == NULL) ? NULL : strchr (input + 1, '\t');
+        if (output_filename == NULL || strchr (output_filename + 1, '\t') != NULL)
+        {
+            printf ("error Expected <name-on-tape> <input> <output>, separated by tabs.\n");
+            fflush (stdout);
+            continue;
+        }
+        *input++ = '\0';
+        *output_filename++ = '\0';
+
+        /* Inline program bytes are always consumed, so that the stream stays in step */
+        if (input [0] == '@')
+        {
+            char *end;
+            unsigned long length = strtoul (input + 1, &end, 10);
+            if (end == input + 1 || *end != '\0')
+            {
+                snprintf (error, sizeof (error), "Invalid inline program length '%s'.", input + 1);
+            }
+            else if (length > TAPEWAVE_MAX_PROGRAM_LENGTH)
+            {
+                while (length > 0 && fgetc (stdin) != EOF)
+                {
+                    length--;
+                }
+                snprintf (error, sizeof (error), "Inline program is too large.");
+            }
+            else if (fread (inline_program, 1, length, stdin) != length)
+            {
+                printf ("error Inline program was cut short.\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+            else
+            {
+                program = inline_program;
+                program_length = length;
+            }
+        }
+        else
+        {
+            program = read_program (input, &program_length, error, sizeof (error));
+        }
+
+        uint16_t packed_length;
+        char report [256] = "";
+        uint8_t *packed = (program != NULL && settings->compress) ?
+                          compress_program (settings, program, program_length, &packed_length, report, sizeof (report)) : NULL;
+
+        /* Stdout carries the responses, so the outcome of compressing goes to stderr */
+        if (report [0] != '\0')
+        {
+            fprintf (stderr, "%s: %s\n", tape_name, report);
+        }
+
+        if (packed != NULL)
+        {
+            if (program != inline_program)
+            {
+                free (program);
+            }
+            program = packed;
+            program_length = packed_length;
+        }
+
+        if (program != NULL)
+        {
+            /* A returned file takes its format from the extension following the '-' */
+            if (output_filename [0] == '-')
+            {
+                output_format_t format = (output_filename [1] == '\0') ? OUTPUT_WAV : output_format (output_filename);
+                if (format == OUTPUT_UNKNOWN)
+                {
+                    snprintf (error, sizeof (error), "Returned output must be '-', '-.wav', '-.flac', or '-.tzx'.");
+                }
+                else if (encode_memory (&encoder, settings, format, tape_name, program, program_length,
+                                        &output, error, sizeof (error)))
+                {
+                    returned = true;
+                }
+            }
+            else if (encode_program (&encoder, settings, tape_name, program, program_length, output_filename,
+                                     &output_file_size, error, sizeof (error)))
+            {
+                error [0] = '\0';
+            }
+
+            if (program != inline_program)
+            {
+                free (program);
+            }
+        }
+
+        if (returned)
+        {
+            printf ("ok %zu\n", output.used);
+            fwrite (output.buffer, 1, output.used, stdout);
+        }
+        else if (error [0] == '\0')
+        {
+            printf ("ok %u\n", output_file_size);
+        }
+        else
+        {
+            printf ("error %s\n", error);
+        }
+
+        if (fflush (stdout) != 0)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    free (line);
+    free (inline_program);
+    free (output.buffer);
+    tapewave_encoder_free (&encoder);
+
+    return status;
+}
+
+
+/*
+ * Print a string as a JSON string literal.
+ */
+static void print_json_string (const char *string)
+{
+    putchar ('"');
+    for (const char *c = string; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            printf ("\\%c", *c);
+        }
+        else if ((unsigned char) *c < 0x20)
+        {
+            printf ("\\u%04x", *c);
+        }
+        else
+        {
+            putchar (*c);
+        }
+    }
+    putchar ('"');
+}
+
+
+/*
+ * Print the size, duration, and layout of the tape for a program, as a JSON
+ * object, without reading or rendering it. Only the file's length is needed.
+ */
+static bool info_file (const tapewave_options_t *options, const char *input_filename)
+{
+    struct stat input_stat;
+    if (stat (input_filename, &input_stat) < 0 || !S_ISREG (input_stat.st_mode))
+    {
+        fprintf (stderr, "Failed to open input file '%s'.\n", input_filename);
+        return false;
+    }
+    if (input_stat.st_size > TAPEWAVE_MAX_PROGRAM_LENGTH)
+    {
+        fprintf (stderr, "Error: Program '%s' is too large for a single tape. Use --split <bytes> to write it as several "
+                 "parts.\n", input_filename);
+        return false;
+    }
+    if (options->turbo != 0 && input_stat.st_size > TAPEWAVE_TURBO_MAX_PROGRAM_LENGTH)
+    {
+        fprintf (stderr, "Error: Program '%s' is too large.\n", input_filename);
+        return false;
+    }
+
+    uint16_t program_length = input_stat.st_size;
+    tapewave_section_t sections [INFO_MAX_SECTIONS];
+    int section_count = tapewave_tape_layout (options, program_length, sections, INFO_MAX_SECTIONS);
+    if (section_count <= 0 || section_count > INFO_MAX_SECTIONS)
+    {
+        fprintf (stderr, "Failed to lay out tape for '%s'.\n", input_filename);
+        return false;
+    }
+
+    uint32_t sample_rate = options->sample_rate;
+    uint64_t samples = sections [section_count - 1].start + sections [section_count - 1].samples;
+
+    /* Compared against the same tape with the standard timing */
+    tapewave_options_t standard = *options;
+    timing_profile (&standard, "standard");
+    double saved_seconds = tape_seconds (&standard, program_length) - (double) samples / sample_rate;
+
+    printf ("{\"input\": ");
+    print_json_string (input_filename);
+    printf (", \"program_bytes\": %u, \"sample_rate\": %u, \"wav_bytes\": %u, \"samples\": %" PRIu64 ", "
+            "\"seconds\": %.6f, \"saved_seconds\": %.6f, \"sections\": [",
+            program_length, sample_rate, tapewave_wav_size (options, program_length), samples,
+            (double) samples / sample_rate, saved_seconds);
+
+    for (int i = 0; i < section_count; i++)
+    {
+        const tapewave_section_t *section = &sections [i];
+        const char *type = !section->is_block ? "silence" :
+                           (section->key_code == 0x16) ? "header" :
+                           (section->speed > 1) ? "turbo" :
+                           (options->turbo != 0) ? "loader" : "program";
+
+        printf ("%s{\"type\": \"%s\", \"start\": %" PRIu64 ", \"samples\": %" PRIu64 ", \"seconds\": %.6f",
+                (i == 0) ? "" : ", ", type, section->start, section->samples, (double) section->samples / sample_rate);
+
+        if (section->is_block)
+        {
+            printf (", \"speed\": %u, \"data_bytes\": %u, \"leader_samples\": %" PRIu64 ", \"data_samples\": %" PRIu64 ", "
+                    "\"trailer_samples\": %" PRIu64,
+                    section->speed, section->data_length, section->leader_samples, section->data_samples,
+                    section->trailer_samples);
+        }
+        printf ("}");
+    }
+    printf ("]}\n");
+
+    return true;
+}
+
+
+/*
+ * Decode each program in a single tape recording, reporting them on stdout.
+ * If 'output_filename' is not NULL, the first program is written to it.
+ */
+static bool decode_file (const char *input_filename, const char *output_filename)
+{
+    int input_fd = open (input_filename, O_RDONLY);
+    if (input_fd < 0)
+    {
+        fprintf (stderr, "Failed to open input file '%s'.\n", input_filename);
+        return false;
+    }
+
+    struct stat input_stat;
+    if (fstat (input_fd, &input_stat) < 0 || input_stat.st_size == 0)
+    {
+        fprintf (stderr, "Failed to read input file '%s'.\n", input_filename);
+        close (input_fd);
+        return false;
+    }
+
+    /* Map the recording, rather than copying it into memory */
+    uint8_t *wav = mmap (NULL, input_stat.st_size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+    close (input_fd);
+    if (wav == MAP_FAILED)
+    {
+        fprintf (stderr, "Failed to map input file '%s'.\n", input_filename);
+        return false;
+    }
+
+    tapewave_decode_result_t result;
+    tapewave_decoder_t *decoder = tapewave_decoder_open (wav, input_stat.st_size, &result);
+    if (decoder == NULL)
+    {
+        fprintf (stderr, "%s: %s.\n", input_filename, tapewave_decode_result_string (result));
+        munmap (wav, input_stat.st_size);
+        return false;
+    }
+
+    bool success = true;
+    uint32_t program_count = 0;
+    tapewave_program_t program;
+
+    while ((result = tapewave_decoder_next (decoder, &program)) != TAPEWAVE_DECODE_END)
+    {
+        printf ("%s: %.1f s: '%s', %u bytes: %s.\n", input_filename, program.start_time, program.name,
+                program.length, tapewave_decode_result_string (result));
+
+        if (result != TAPEWAVE_DECODE_OK)
+        {
+            success = false;
+        }
+        else if (output_filename != NULL && program_count == 0)
+        {
+            FILE *output_file = fopen (output_filename, "w");
+            if (output_file == NULL || fwrite (program.data, 1, program.length, output_file) != program.length)
+            {
+                fprintf (stderr, "Failed to write output file '%s'.\n", output_filename);
+                success = false;
+            }
+            if (output_file != NULL && fclose (output_file) != 0)
+            {
+                success = false;
+            }
+        }
+
+        program_count++;
+        tapewave_program_free (&program);
+    }
+
+    if (program_count == 0)
+    {
+        fprintf (stderr, "%s: No programs found.\n", input_filename);
+        success = false;
+    }
+
+    tapewave_decoder_close (decoder);
+    munmap (wav, input_stat.st_size);
+
+    return success;
+}
+
+
+/*
+ * Parse a size in bytes, with an optional K, M, or G suffix.
+ */
+static bool parse_size (const char *string, uint64_t *size)
+{
+    char *end;
+    uint64_t value = strtoull (string, &end, 10);
+
+    if (end == string)
+    {
+        return false;
+    }
+
+    switch (toupper (*end))
+    {
+        case 'G':
+            value *= 1024;
+            /* Fall through */
+        case 'M':
+            value *= 1024;
+            /* Fall through */
+        case 'K':
+            value *= 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+
+    if (*end != '\0')
+    {
+        return false;
+    }
+
+    *size = value;
+    return true;
+}
+
+
+/*
+ * Parse a whole, non-negative number.
+ */
+static bool parse_number (const char *string, uint32_t *number)
+{
+    char *end;
+    unsigned long value = strtoul (string, &end, 10);
+
+    if (end == string || *end != '\0' || string [0] == '-' || value > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *number = value;
+    return true;
+}
+
+
+/*
+ * Print usage information.
+ */
+static void usage (const char *argv_0)
+{
+    fprintf (stderr, "Usage: %s [--rate <hz>] [--turbo <speed>] [--timing <profile>] [--compress] [--mmap [--jobs <count>]] [--incremental] [--cache <dir> [--cache-size <bytes>]] <name-on-tape> <input-file> <output-file.wav | .flac | .tzx | ->\n", argv_0);
+    fprintf (stderr, "       %s --split <bytes> [--separate] [--rate <hz>] [--timing <profile>] [--program-gap <ms>] <name-on-tape> <input-file> <output-file.wav | ->\n", argv_0);
+    fprintf (stderr, "       %s --batch [--jobs <count>] [--rate <hz>] [--turbo <speed>] [--timing <profile>] [--compress] [--mmap] [--incremental] [--cache <dir> [--cache-size <bytes>]] <manifest-file | ->\n", argv_0);
+    fprintf (stderr, "       %s --worker [--jobs <count>] [--rate <hz>] [--turbo <speed>] [--timing <profile>] [--compress] [--mmap] [--incremental] [--cache <dir> [--cache-size <bytes>]]\n", argv_0);
+    fprintf (stderr, "       %s --multi [--rate <hz>] [--turbo <speed>] [--timing <profile>] [--compress] [--program-gap <ms>] <output-file.wav | -> <name-on-tape> <input-file> [<name-on-tape> <input-file>]...\n", argv_0);
+    fprintf (stderr, "       %s --info [--rate <hz>] [--turbo <speed>] [--timing <profile>] <input-file>...\n", argv_0);
+    fprintf (stderr, "       %s --decode [--output <output-file>] <input-file.wav>...\n", argv_0);
+    fprintf (stderr, "Timing profiles are 'standard' and 'minimal', adjusted by [--leader <bits>] [--gap <ms>] [--pad <ms>].\n");
+}
+
+
+/*
+ * Parse the command line and run the selected mode. The positional arguments
+ * are collected into 'arguments', which holds room for all of argv.
+ */
+static int run (int argc, char **argv, const char **arguments)
+{
+    const char *argv_0 = argv [0];
+    enum { MODE_ENCODE, MODE_BATCH, MODE_DECODE, MODE_WORKER, MODE_INFO, MODE_MULTI } mode = MODE_ENCODE;
+    const char *output_filename = NULL;
+    long thread_count = sysconf (_SC_NPROCESSORS_ONLN);
+    uint32_t jobs = 0;
+    encode_settings_t settings = { .use_mmap = false, .incremental = false, .compress = false,
+                                   .cache = { .directory = NULL, .max_size = CACHE_DEFAULT_SIZE } };
+    tapewave_options_init (&settings.options);
+
+    /* The size of the cache is kept track of between stores */
+    cache_usage_t cache_usage;
+    cache_usage_init (&cache_usage);
+    settings.cache.usage = &cache_usage;
+
+    /* A timing profile, with any of its values replaced by --leader, --gap, or --pad */
+    const char *timing = "standard";
+    uint32_t leader_bits = UINT32_MAX;
+    uint32_t gap_ms = UINT32_MAX;
+    uint32_t pad_ms = UINT32_MAX;
+
+    /* Splitting of files too large for a single tape */
+    uint64_t split_size = 0;
+    bool split_separate = false;
+
+    /* Separate the options from the positional arguments. A lone '-' is positional. */
+    int argument_count = 0;
+    bool options_done = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv [i];
+        const char *value = (i + 1 < argc) ? argv [i + 1] : NULL;
+
+        if (options_done || arg [0] != '-' || arg [1] == '\0')
+        {
+            arguments [argument_count++] = arg;
+        }
+        else if (strcmp (arg, "--") == 0)
+        {
+            options_done = true;
+        }
+        else if (strcmp (arg, "--batch") == 0)
+        {
+            mode = MODE_BATCH;
+        }
+        else if (strcmp (arg, "--decode") == 0)
+        {
+            mode = MODE_DECODE;
+        }
+        else if (strcmp (arg, "--worker") == 0)
+        {
+            mode = MODE_WORKER;
+        }
+        else if (strcmp (arg, "--multi") == 0)
+        {
+            mode = MODE_MULTI;
+        }
+        else if (strcmp (arg, "--info") == 0 || strcmp (arg, "--dry-run") == 0)
+        {
+            mode = MODE_INFO;
+        }
+        else if (strcmp (arg, "--jobs") == 0 && value != NULL && parse_number (value, &jobs) && jobs != 0)
+        {
+            thread_count = jobs;
+            i++;
+        }
+        else if (strcmp (arg, "--output") == 0 && value != NULL)
+        {
+            output_filename = value;
+            i++;
+        }
+        else if (strcmp (arg, "--rate") == 0 && value != NULL && parse_number (value, &settings.options.sample_rate))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--turbo") == 0 && value != NULL && parse_number (value, &settings.options.turbo))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--timing") == 0 && value != NULL)
+        {
+            timing = value;
+            i++;
+        }
+        else if (strcmp (arg, "--leader") == 0 && value != NULL && parse_number (value, &leader_bits))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--gap") == 0 && value != NULL && parse_number (value, &gap_ms))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--pad") == 0 && value != NULL && parse_number (value, &pad_ms))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--program-gap") == 0 && value != NULL &&
+                 parse_number (value, &settings.options.program_gap_ms))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--split") == 0 && value != NULL && parse_size (value, &split_size))
+        {
+            i++;
+        }
+        else if (strcmp (arg, "--separate") == 0)
+        {
+            split_separate = true;
+        }
+        else if (strcmp (arg, "--compress") == 0)
+        {
+            settings.compress = true;
+        }
+        else if (strcmp (arg, "--mmap") == 0)
+        {
+            settings.use_mmap = true;
+        }
+        else if (strcmp (arg, "--incremental") == 0)
+        {
+            settings.incremental = true;
+        }
+        else if (strcmp (arg, "--cache") == 0 && value != NULL)
+        {
+            settings.cache.directory = value;
+            i++;
+        }
+        else if (strcmp (arg, "--cache-size") == 0 && value != NULL && parse_size (value, &settings.cache.max_size))
+        {
+            i++;
+        }
+        else
+        {
+            usage (argv_0);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (settings.options.sample_rate < TAPEWAVE_MIN_SAMPLE_RATE || settings.options.sample_rate > TAPEWAVE_MAX_SAMPLE_RATE)
+    {
+        fprintf (stderr, "Sample rate must be between %u and %u Hz.\n", TAPEWAVE_MIN_SAMPLE_RATE, TAPEWAVE_MAX_SAMPLE_RATE);
+        return EXIT_FAILURE;
+    }
+
+    /* The turbo block is rendered at the sample rate divided by the speed-up */
+    uint32_t turbo = settings.options.turbo;
+    if (turbo != 0 && (turbo < TAPEWAVE_MIN_TURBO || turbo > TAPEWAVE_MAX_TURBO))
+    {
+        fprintf (stderr, "Turbo speed-up must be between %u and %u.\n", TAPEWAVE_MIN_TURBO, TAPEWAVE_MAX_TURBO);
+        return EXIT_FAILURE;
+    }
+    if (turbo != 0 && (settings.options.sample_rate % turbo != 0 ||
+                       settings.options.sample_rate / turbo < TAPEWAVE_MIN_TURBO_SAMPLE_RATE))
+    {
+        fprintf (stderr, "With --turbo %u, the sample rate must be a multiple of %u, of at least %u Hz, such as %u Hz.\n",
+                 turbo, turbo, turbo * TAPEWAVE_MIN_TURBO_SAMPLE_RATE, turbo * 12000);
+        return EXIT_FAILURE;
+    }
+
+    if (!timing_profile (&settings.options, timing))
+    {
+        fprintf (stderr, "Unknown timing profile '%s'. The profiles are 'standard' and 'minimal'.\n", timing);
+        return EXIT_FAILURE;
+    }
+    if (leader_bits != UINT32_MAX)
+    {
+        settings.options.leader_bits = leader_bits;
+    }
+    if (gap_ms != UINT32_MAX)
+    {
+        settings.options.gap_ms = gap_ms;
+    }
+    if (pad_ms != UINT32_MAX)
+    {
+        settings.options.pad_ms = pad_ms;
+    }
+
+    if (settings.options.leader_bits < TAPEWAVE_MIN_LEADER_BITS || settings.options.leader_bits > TAPEWAVE_MAX_LEADER_BITS)
+    {
+        fprintf (stderr, "Leader must be between %u and %u bits.\n", TAPEWAVE_MIN_LEADER_BITS, TAPEWAVE_MAX_LEADER_BITS);
+        return EXIT_FAILURE;
+    }
+    if (settings.options.gap_ms > TAPEWAVE_MAX_GAP_MS || settings.options.pad_ms > TAPEWAVE_MAX_GAP_MS)
+    {
+        fprintf (stderr, "Gap and pad must be at most %u ms.\n", TAPEWAVE_MAX_GAP_MS);
+        return EXIT_FAILURE;
+    }
+    if (settings.options.program_gap_ms > TAPEWAVE_MAX_PROGRAM_GAP_MS)
+    {
+        fprintf (stderr, "Program gap must be at most %u ms.\n", TAPEWAVE_MAX_PROGRAM_GAP_MS);
+        return EXIT_FAILURE;
+    }
+
+    /* A split file is written on its own, rather than as part of another mode */
+    if ((split_size != 0 || split_separate) && mode != MODE_ENCODE)
+    {
+        fprintf (stderr, "--split and --separate are not supported with --batch, --worker, --multi, --info, or --decode.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Batch mode */
+    if (mode == MODE_BATCH)
+    {
+        if (argument_count != 1)
+        {
+            usage (argv_0);
+            return EXIT_FAILURE;
+        }
+
+        if (thread_count < 1)
+        {
+            thread_count = 1;
+        }
+
+        return batch_main (&settings, arguments [0], thread_count);
+    }
+
+    /* Multi-program mode: an output file, followed by pairs of <name-on-tape> <input-file> */
+    if (mode == MODE_MULTI)
+    {
+        if (argument_count < 3 || argument_count % 2 != 1)
+        {
+            usage (argv_0);
+            return EXIT_FAILURE;
+        }
+
+        if (settings.use_mmap || settings.incremental || settings.cache.directory != NULL)
+        {
+            fprintf (stderr, "--mmap, --incremental, and --cache are not supported with --multi.\n");
+            return EXIT_FAILURE;
+        }
+
+        return multi_main (&settings, arguments [0], &arguments [1], (argument_count - 1) / 2);
+    }
+
+    /* Info mode */
+    if (mode == MODE_INFO)
+    {
+        if (argument_count == 0)
+        {
+            usage (argv_0);
+            return EXIT_FAILURE;
+        }
+
+        bool success = true;
+        for (int i = 0; i < argument_count; i++)
+        {
+            success &= info_file (&settings.options, arguments [i]);
+        }
+
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* Decode mode */
+    if (mode == MODE_DECODE)
+    {
+        /* Only a single recording can be written to the output file */
+        if (argument_count == 0 || (output_filename != NULL && argument_count != 1))
+        {
+            usage (argv_0);
+            return EXIT_FAILURE;
+        }
+
+        bool success = true;
+        for (int i = 0; i < argument_count; i++)
+        {
+            success &= decode_file (arguments [i], output_filename);
+        }
+
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* Each tape is split between the threads, when rendered into memory or a memory-mapping */
+    if (thread_count < 1)
+    {
+        thread_count = 1;
+    }
+    settings.options.threads = (thread_count < TAPEWAVE_MAX_THREADS) ? thread_count : TAPEWAVE_MAX_THREADS;
+
+    /* Worker mode */
+    if (mode == MODE_WORKER)
+    {
+        if (argument_count != 0)
+        {
+            usage (argv_0);
+            return EXIT_FAILURE;
+        }
+
+        return worker_main (&settings);
+    }
+
+    /* Check parameters */
+    if (argument_count != 3)
+    {
+        usage (argv_0);
+        return EXIT_FAILURE;
+    }
+
+    const char *tape_name = arguments [0];
+    const char *input_filename = arguments [1];
+    output_filename = arguments [2];
+
+    /* Split mode */
+    if (split_size != 0 || split_separate)
+    {
+        /* 64K is one byte more than the length field holds, so is taken as the largest part */
+        if (split_size == TAPEWAVE_MAX_PROGRAM_LENGTH + 1)
+        {
+            split_size = TAPEWAVE_MAX_PROGRAM_LENGTH;
+        }
+        if (split_size < 1 || split_size > TAPEWAVE_MAX_PROGRAM_LENGTH)
+        {
+            fprintf (stderr, "Split parts must be between 1 and %u bytes.\n", TAPEWAVE_MAX_PROGRAM_LENGTH);
+            return EXIT_FAILURE;
+        }
+
+        /* The parts are data, rather than programs that can be run on their own */
+        if (settings.options.turbo != 0 || settings.compress)
+        {
+            fprintf (stderr, "--turbo and --compress are not supported with --split.\n");
+            return EXIT_FAILURE;
+        }
+        if (!split_separate && (settings.use_mmap || settings.incremental || settings.cache.directory != NULL))
+        {
+            fprintf (stderr, "--mmap, --incremental, and --cache are only supported with --split when used with --separate.\n");
+            return EXIT_FAILURE;
+        }
+
+        return split_main (&settings, tape_name, input_filename, output_filename, split_size, split_separate);
+    }
+
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+    uint32_t output_file_size = 0;
+    char report [256] = "";
+    char error [256];
+
+    if (!encode_file (&encoder, &settings, tape_name, input_filename, output_filename,
+                      &output_file_size, report, sizeof (report), error, sizeof (error)))
+    {
+        fprintf (stderr, "%s\n", error);
+        tapewave_encoder_free (&encoder);
+        return EXIT_FAILURE;
+    }
+
+    /* Reported on stderr, as stdout may be carrying the wave file */
+    if (report [0] != '\0')
+    {
+        fprintf (stderr, "%s\n", report);
+    }
+
+    tapewave_encoder_free (&encoder);
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * Entry point.
+ */
+int main (int argc, char **argv)
+{
+    const char **arguments = calloc (argc, sizeof (const char *));
+    if (arguments == NULL)
+    {
+        fprintf (stderr, "Failed to allocate memory for arguments.\n");
+        return EXIT_FAILURE;
+    }
+
+    int status = run (argc, argv, arguments);
+    free (arguments);
+
+    return status;
 }
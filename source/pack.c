@@ -0,0 +1,405 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+#include "turbo.h"
+
+/*
+ * The compressed stream is a series of byte-aligned tokens, chosen so that each
+ * is unpacked by a single LDIR:
+ *
+ *   0x00 - 0x7f: A run of 1 to 128 literal bytes follows.
+ *   0x80 - 0xfe: Copy 3 to 129 bytes from earlier in the output. The distance
+ *                back follows, negated, as a 16-bit little-endian value.
+ *   0xff:        End of the stream.
+ *
+ * The program is loaded to 0x9800 with the stream behind a short prologue. The
+ * prologue moves the stream up to the top of the usable memory, and the
+ * depacker to just above it, so that the program can be unpacked in place.
+ */
+#define TOKEN_MATCH     0x80
+#define TOKEN_END       0xff
+#define MAX_LITERALS    TOKEN_MATCH
+#define MIN_MATCH       3
+#define MAX_MATCH       (TOKEN_END - TOKEN_MATCH - 1 + MIN_MATCH)
+
+/* Matches are found through chains of earlier positions sharing a hash of their first three bytes. */
+#define HASH_BITS       12
+#define HASH_SIZE       (1 << HASH_BITS)
+#define MAX_CHAIN       256
+
+#define PROLOGUE_SIZE   31
+#define DEPACKER_SIZE   36
+
+/* The depacker runs from the very top of the usable memory. */
+#define DEPACKER_ADDRESS    (TURBO_RAM_END - DEPACKER_SIZE)
+
+/* Offsets of fields in the prologue that depend on the length of the stream. */
+#define PROLOGUE_STREAM_END     0x01
+#define PROLOGUE_STREAM_LENGTH  0x07
+#define PROLOGUE_STREAM_START   0x17
+
+/* T-states taken by the depacker for each token, besides 21 per byte copied. */
+#define LITERAL_CYCLES  51
+#define MATCH_CYCLES    136
+#define END_CYCLES      49
+
+/* T-states taken by the prologue, besides 21 per byte of the stream moved. */
+#define PROLOGUE_CYCLES (90 + DEPACKER_SIZE * COPY_CYCLES - 10)
+
+/* T-states per byte copied by LDIR or LDDR. */
+#define COPY_CYCLES     21
+
+/* The two bytes of a 16-bit operand, low byte first. */
+#define WORD(value)     ((value) & 0xff), ((value) >> 8)
+
+/* Moves the stream and depacker into place, then starts the depacker. */
+static const uint8_t pack_prologue [PROLOGUE_SIZE] = {
+    0x21, WORD (0),                         /* 0000  ld hl, stream_end - 1          */
+    0x11, WORD (DEPACKER_ADDRESS - 1),      /* 0003  ld de, DEPACKER_ADDRESS - 1    */
+    0x01, WORD (0),                         /* 0006  ld bc, stream_length           */
+    0xed, 0xb8,                             /* 0009  lddr                           */
+    0x21, WORD (TURBO_LOAD_ADDRESS + PROLOGUE_SIZE),
+                                            /* 000b  ld hl, depacker                */
+    0x11, WORD (DEPACKER_ADDRESS),          /* 000e  ld de, DEPACKER_ADDRESS        */
+    0x01, WORD (DEPACKER_SIZE),             /* 0011  ld bc, DEPACKER_SIZE           */
+    0xed, 0xb0,                             /* 0014  ldir                           */
+    0x21, WORD (0),                         /* 0016  ld hl, stream                  */
+    0x11, WORD (TURBO_LOAD_ADDRESS),        /* 0019  ld de, 0x9800                  */
+    0xc3, WORD (DEPACKER_ADDRESS),          /* 001c  jp DEPACKER_ADDRESS            */
+};
+
+/* Unpacks the stream at hl to de, then runs the program. */
+static const uint8_t pack_depacker [DEPACKER_SIZE] = {
+    0x7e,                                   /* 0000  token: ld a, (hl)              */
+    0x23,                                   /* 0001  inc hl                         */
+    0xfe, TOKEN_MATCH,                      /* 0002  cp TOKEN_MATCH                 */
+    0x30, 0x08,                             /* 0004  jr nc, match                   */
+    0x4f,                                   /* 0006  ld c, a                        */
+    0x06, 0x00,                             /* 0007  ld b, 0                        */
+    0x03,                                   /* 0009  inc bc                         */
+    0xed, 0xb0,                             /* 000a  ldir                           */
+    0x18, 0xf2,                             /* 000c  jr token                       */
+    0xfe, TOKEN_END,                        /* 000e  match: cp TOKEN_END            */
+    0xca, WORD (TURBO_LOAD_ADDRESS),        /* 0010  jp z, 0x9800                   */
+    0xd6, TOKEN_MATCH - MIN_MATCH,          /* 0013  sub TOKEN_MATCH - MIN_MATCH    */
+    0x4f,                                   /* 0015  ld c, a                        */
+    0x06, 0x00,                             /* 0016  ld b, 0                        */
+    0x7e,                                   /* 0018  ld a, (hl)                     */
+    0x23,                                   /* 0019  inc hl                         */
+    0xe5,                                   /* 001a  push hl                        */
+    0x66,                                   /* 001b  ld h, (hl)                     */
+    0x6f,                                   /* 001c  ld l, a                        */
+    0x19,                                   /* 001d  add hl, de                     */
+    0xed, 0xb0,                             /* 001e  ldir                           */
+    0xe1,                                   /* 0020  pop hl                         */
+    0x23,                                   /* 0021  inc hl                         */
+    0x18, 0xdc,                             /* 0022  jr token                       */
+};
+
+/* State of the compressor. */
+typedef struct pack_state_s {
+    const uint8_t *program;
+    uint32_t program_length;
+
+    /* Most recent position for each hash, and the previous position with the same hash */
+    int32_t head [HASH_SIZE];
+    int32_t *previous;
+
+    uint8_t *stream;
+    uint32_t stream_size;
+    uint32_t stream_length;
+    uint32_t unpacked_length;
+
+    /* The furthest that the depacker's output runs ahead of its input */
+    int64_t lead;
+    uint64_t cycles;
+} pack_state_t;
+
+
+/*
+ * Hash the three bytes at a position.
+ */
+static uint32_t pack_hash (const uint8_t *data)
+{
+    uint32_t value = (data [0] << 16) | (data [1] << 8) | data [2];
+
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+/*
+ * Add a position to the hash chains.
+ */
+static void pack_insert (pack_state_t *state, uint32_t position)
+{
+    if (position + MIN_MATCH <= state->program_length)
+    {
+        uint32_t hash = pack_hash (&state->program [position]);
+        state->previous [position] = state->head [hash];
+        state->head [hash] = position;
+    }
+}
+
+
+/*
+ * Find the longest match for the bytes at a position, among those before it.
+ * Returns the length of the match, which is 0 if there is none.
+ */
+static uint32_t pack_find (const pack_state_t *state, uint32_t position, uint32_t *distance)
+{
+    uint32_t best_length = 0;
+    uint32_t max_length = state->program_length - position;
+
+    if (max_length < MIN_MATCH)
+    {
+        return 0;
+    }
+    if (max_length > MAX_MATCH)
+    {
+        max_length = MAX_MATCH;
+    }
+
+    const uint8_t *data = &state->program [position];
+    int32_t candidate = state->head [pack_hash (data)];
+
+    for (uint32_t depth = 0; candidate >= 0 && depth < MAX_CHAIN; depth++)
+    {
+        const uint8_t *match = &state->program [candidate];
+        uint32_t length = 0;
+
+        while (length < max_length && match [length] == data [length])
+        {
+            length++;
+        }
+
+        if (length > best_length)
+        {
+            best_length = length;
+            *distance = position - candidate;
+
+            if (length == max_length)
+            {
+                break;
+            }
+        }
+
+        candidate = state->previous [candidate];
+    }
+
+    return (best_length >= MIN_MATCH) ? best_length : 0;
+}
+
+
+/*
+ * Account for a token, once it has been written to the stream.
+ */
+static void pack_token_done (pack_state_t *state, uint32_t cycles)
+{
+    int64_t lead = (int64_t) state->unpacked_length - state->stream_length;
+
+    if (lead > state->lead)
+    {
+        state->lead = lead;
+    }
+    state->cycles += cycles;
+}
+
+
+/*
+ * Write a run of literal bytes to the stream.
+ * Returns false if the stream has run out of room.
+ */
+static bool pack_literals (pack_state_t *state, uint32_t start, uint32_t count)
+{
+    while (count > 0)
+    {
+        uint32_t run = (count > MAX_LITERALS) ? MAX_LITERALS : count;
+
+        if (state->stream_size - state->stream_length < 1 + run)
+        {
+            return false;
+        }
+
+        state->stream [state->stream_length++] = run - 1;
+        memcpy (&state->stream [state->stream_length], &state->program [start], run);
+        state->stream_length += run;
+        state->unpacked_length += run;
+        pack_token_done (state, LITERAL_CYCLES + run * COPY_CYCLES);
+
+        start += run;
+        count -= run;
+    }
+
+    return true;
+}
+
+
+/*
+ * Write a match to the stream.
+ * Returns false if the stream has run out of room.
+ */
+static bool pack_match (pack_state_t *state, uint32_t length, uint32_t distance)
+{
+    uint16_t negated = -distance;
+
+    if (state->stream_size - state->stream_length < 3)
+    {
+        return false;
+    }
+
+    state->stream [state->stream_length++] = TOKEN_MATCH + length - MIN_MATCH;
+    state->stream [state->stream_length++] = negated & 0xff;
+    state->stream [state->stream_length++] = negated >> 8;
+    state->unpacked_length += length;
+    pack_token_done (state, MATCH_CYCLES + length * COPY_CYCLES);
+
+    return true;
+}
+
+
+/*
+ * Compress the program into a stream of tokens. Each match is taken unless
+ * the next position starts a longer one, or it would not save any bytes.
+ * Returns false if the stream has run out of room.
+ */
+static bool pack_stream (pack_state_t *state)
+{
+    uint32_t literal_start = 0;
+    uint32_t position = 0;
+
+    while (position < state->program_length)
+    {
+        uint32_t distance = 0;
+        uint32_t length = pack_find (state, position, &distance);
+        pack_insert (state, position);
+
+        /* A match of the shortest length takes as many bytes as it replaces, and
+         * ends the run of literals, so that any that follow need a new token */
+        if (length == MIN_MATCH && position != literal_start)
+        {
+            length = 0;
+        }
+
+        if (length != 0)
+        {
+            uint32_t next_distance;
+            if (pack_find (state, position + 1, &next_distance) > length)
+            {
+                position++;
+                continue;
+            }
+
+            if (!pack_literals (state, literal_start, position - literal_start) ||
+                !pack_match (state, length, distance))
+            {
+                return false;
+            }
+
+            for (uint32_t i = 1; i < length; i++)
+            {
+                pack_insert (state, position + i);
+            }
+            position += length;
+            literal_start = position;
+        }
+        else
+        {
+            position++;
+        }
+    }
+
+    if (!pack_literals (state, literal_start, position - literal_start) ||
+        state->stream_length == state->stream_size)
+    {
+        return false;
+    }
+    state->stream [state->stream_length++] = TOKEN_END;
+    pack_token_done (state, END_CYCLES);
+
+    return true;
+}
+
+
+/*
+ * Compress a program behind a depacker.
+ */
+uint8_t *pack_program (const uint8_t *program, uint16_t program_length,
+                       uint16_t *packed_length, double *depack_time)
+{
+    pack_state_t *state = calloc (1, sizeof (pack_state_t));
+    if (state == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* Matches are only taken where they save bytes, so at worst, every byte is a literal */
+    state->program = program;
+    state->program_length = program_length;
+    state->previous = calloc (program_length + 1, sizeof (int32_t));
+    state->stream_size = program_length + program_length / MAX_LITERALS + 2;
+    state->stream = malloc (state->stream_size);
+    if (state->previous == NULL || state->stream == NULL)
+    {
+        free (state->previous);
+        free (state->stream);
+        free (state);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset (state->head, 0xff, sizeof (state->head));
+
+    /* A stream that outgrows the program stored as literals is never worth loading */
+    bool packed_stream = pack_stream (state);
+
+    /* The stream is unpacked in place, from the top of memory down to 0x9800. The
+     * output must never overtake the part of the stream still to be read. */
+    int64_t stream_start = DEPACKER_ADDRESS - (int64_t) state->stream_length;
+    uint32_t length = PROLOGUE_SIZE + DEPACKER_SIZE + state->stream_length;
+    uint8_t *packed = NULL;
+
+    if (!packed_stream || stream_start < TURBO_LOAD_ADDRESS + PROLOGUE_SIZE + DEPACKER_SIZE ||
+        TURBO_LOAD_ADDRESS + state->lead > stream_start || length > UINT16_MAX)
+    {
+        errno = EFBIG;
+    }
+    else if ((packed = malloc (length)) == NULL)
+    {
+        errno = ENOMEM;
+    }
+    else
+    {
+        uint16_t stream_end = TURBO_LOAD_ADDRESS + length - 1;
+
+        memcpy (packed, pack_prologue, PROLOGUE_SIZE);
+        packed [PROLOGUE_STREAM_END + 0] = stream_end & 0xff;
+        packed [PROLOGUE_STREAM_END + 1] = stream_end >> 8;
+        packed [PROLOGUE_STREAM_LENGTH + 0] = state->stream_length & 0xff;
+        packed [PROLOGUE_STREAM_LENGTH + 1] = state->stream_length >> 8;
+        packed [PROLOGUE_STREAM_START + 0] = stream_start & 0xff;
+        packed [PROLOGUE_STREAM_START + 1] = stream_start >> 8;
+
+        memcpy (packed + PROLOGUE_SIZE, pack_depacker, DEPACKER_SIZE);
+        memcpy (packed + PROLOGUE_SIZE + DEPACKER_SIZE, state->stream, state->stream_length);
+
+        *packed_length = length;
+        *depack_time = (double) (PROLOGUE_CYCLES + state->stream_length * COPY_CYCLES + state->cycles) / Z80_CLOCK_HZ;
+    }
+
+    free (state->previous);
+    free (state->stream);
+    free (state);
+
+    return packed;
+}
@@ -0,0 +1,25 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+
+/*
+ * Compress a machine-code program, behind a depacker that unpacks it to 0x9800
+ * and runs it. The result is loaded and started in place of the program.
+ *
+ * Returns a newly allocated buffer, or NULL with errno set: EFBIG if the
+ * program cannot be unpacked within the memory available, or if it grows when
+ * compressed, or ENOMEM. The time taken to unpack it, in seconds, is written
+ * to 'depack_time'.
+ */
+uint8_t *pack_program (const uint8_t *program, uint16_t program_length,
+                       uint16_t *packed_length, double *depack_time);
+
+#endif /* PACK_H */
@@ -0,0 +1,215 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define PULSE_X86
+#include <immintrin.h>
+#endif
+
+#include "pulse.h"
+
+typedef size_t (*pulse_kernel_t) (const uint8_t *samples, size_t count, pulse_state_t *state,
+                                  uint32_t *widths, size_t max_widths);
+
+static pulse_kernel_t pulse_kernel = NULL;
+static pthread_once_t pulse_kernel_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Portable kernel, examining one sample at a time.
+ */
+static size_t pulse_widths_scalar (const uint8_t *samples, size_t count, pulse_state_t *state,
+                                   uint32_t *widths, size_t max_widths)
+{
+    size_t width_count = 0;
+    size_t last_edge = state->last_edge;
+    bool level = state->level;
+    size_t i;
+
+    for (i = state->position; i < count && width_count < max_widths; i++)
+    {
+        if (level ? (samples [i] < PULSE_LOW) : (samples [i] > PULSE_HIGH))
+        {
+            widths [width_count++] = i - last_edge;
+            last_edge = i;
+            level = !level;
+        }
+    }
+
+    state->position = i;
+    state->last_edge = last_edge;
+    state->level = level;
+
+    return width_count;
+}
+
+
+/*
+ * Find the edges within one block of samples, given bit-masks of which samples are above
+ * PULSE_HIGH and which are below PULSE_LOW. Shared by the vector kernels, which only differ
+ * in how many samples they can compare at once.
+ *
+ * Returns false if 'widths' filled before the end of the block, in which case
+ * state->position is left just after the last edge found.
+ */
+static inline bool pulse_widths_block (uint32_t high_mask, uint32_t low_mask, size_t block_start,
+                                       pulse_state_t *state, uint32_t *widths, size_t max_widths,
+                                       size_t *width_count)
+{
+    uint32_t search_mask = ~0u;
+
+    while (true)
+    {
+        /* While high, look for the signal falling below PULSE_LOW, and vice versa */
+        uint32_t edges = (state->level ? low_mask : high_mask) & search_mask;
+
+        if (edges == 0)
+        {
+            return true;
+        }
+
+        /* Resume just after the last edge on the next call */
+        if (*width_count == max_widths)
+        {
+            state->position = state->last_edge + 1;
+            return false;
+        }
+
+        uint32_t bit = __builtin_ctz (edges);
+        size_t edge = block_start + bit;
+
+        widths [(*width_count)++] = edge - state->last_edge;
+        state->last_edge = edge;
+        state->level = !state->level;
+
+        /* Continue searching after this edge */
+        search_mask = (bit == 31) ? 0 : (~0u << (bit + 1));
+    }
+}
+
+
+#ifdef PULSE_X86
+/*
+ * SSE2 kernel, comparing 16 samples at a time.
+ */
+__attribute__ ((target ("sse2")))
+static size_t pulse_widths_sse2 (const uint8_t *samples, size_t count, pulse_state_t *state,
+                                 uint32_t *widths, size_t max_widths)
+{
+    /* SSE2 only has signed byte comparisons, so flip the samples' top bit to make them signed */
+    const __m128i sign = _mm_set1_epi8 ((char) 0x80);
+    const __m128i high = _mm_set1_epi8 ((char) (PULSE_HIGH ^ 0x80));
+    const __m128i low = _mm_set1_epi8 ((char) (PULSE_LOW ^ 0x80));
+    size_t width_count = 0;
+    size_t i;
+
+    for (i = state->position; i + 16 <= count; i += 16)
+    {
+        __m128i block = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *) (samples + i)), sign);
+        uint32_t high_mask = _mm_movemask_epi8 (_mm_cmpgt_epi8 (block, high));
+        uint32_t low_mask = _mm_movemask_epi8 (_mm_cmplt_epi8 (block, low));
+
+        if (!pulse_widths_block (high_mask, low_mask, i, state, widths, max_widths, &width_count))
+        {
+            return width_count;
+        }
+    }
+
+    /* Finish off any remaining samples */
+    state->position = i;
+    return width_count + pulse_widths_scalar (samples, count, state, widths + width_count, max_widths - width_count);
+}
+
+
+/*
+ * AVX2 kernel, comparing 32 samples at a time.
+ */
+__attribute__ ((target ("avx2")))
+static size_t pulse_widths_avx2 (const uint8_t *samples, size_t count, pulse_state_t *state,
+                                 uint32_t *widths, size_t max_widths)
+{
+    const __m256i sign = _mm256_set1_epi8 ((char) 0x80);
+    const __m256i high = _mm256_set1_epi8 ((char) (PULSE_HIGH ^ 0x80));
+    const __m256i low = _mm256_set1_epi8 ((char) (PULSE_LOW ^ 0x80));
+    size_t width_count = 0;
+    size_t i;
+
+    for (i = state->position; i + 32 <= count; i += 32)
+    {
+        __m256i block = _mm256_xor_si256 (_mm256_loadu_si256 ((const __m256i *) (samples + i)), sign);
+        uint32_t high_mask = _mm256_movemask_epi8 (_mm256_cmpgt_epi8 (block, high));
+        uint32_t low_mask = _mm256_movemask_epi8 (_mm256_cmpgt_epi8 (low, block));
+
+        if (!pulse_widths_block (high_mask, low_mask, i, state, widths, max_widths, &width_count))
+        {
+            return width_count;
+        }
+    }
+
+    /* Finish off any remaining samples */
+    state->position = i;
+    return width_count + pulse_widths_scalar (samples, count, state, widths + width_count, max_widths - width_count);
+}
+#endif
+
+
+/*
+ * Choose the fastest kernel supported by this CPU.
+ * Setting TAPEWAVE_PULSE_KERNEL to 'scalar', 'sse2' or 'avx2' limits the choice.
+ */
+static void pulse_kernel_init (void)
+{
+    const char *limit = getenv ("TAPEWAVE_PULSE_KERNEL");
+
+    pulse_kernel = pulse_widths_scalar;
+
+    if (limit != NULL && strcmp (limit, "scalar") == 0)
+    {
+        return;
+    }
+
+#ifdef PULSE_X86
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("sse2"))
+    {
+        pulse_kernel = pulse_widths_sse2;
+    }
+
+    if (limit != NULL && strcmp (limit, "sse2") == 0)
+    {
+        return;
+    }
+
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        pulse_kernel = pulse_widths_avx2;
+    }
+#endif
+}
+
+
+/*
+ * Scan samples for edges, writing the distance between them into 'widths'.
+ */
+size_t pulse_widths (const uint8_t *samples, size_t count, pulse_state_t *state,
+                     uint32_t *widths, size_t max_widths)
+{
+    pthread_once (&pulse_kernel_once, pulse_kernel_init);
+
+    return pulse_kernel (samples, count, state, widths, max_widths);
+}
+
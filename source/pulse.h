@@ -0,0 +1,39 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hysteresis thresholds around the 0x80 mid-point of unsigned 8-bit samples.
+ * The signal must rise above PULSE_HIGH or fall below PULSE_LOW to count as an edge. */
+#define PULSE_HIGH  0x88
+#define PULSE_LOW   0x78
+
+/* Position of the pulse-width kernel within a buffer of samples. */
+typedef struct pulse_state_s {
+    size_t position;    /* Next sample to examine */
+    size_t last_edge;   /* Sample index of the most recent edge */
+    bool level;         /* Current level of the signal, true for high */
+} pulse_state_t;
+
+
+/*
+ * Scan samples from state->position up to 'count', writing the distance between
+ * successive edges into 'widths'. Stops early once 'max_widths' have been found.
+ * Returns the number of widths written.
+ *
+ * The work is done by a vectorised kernel where the CPU supports one, chosen at
+ * runtime, with a scalar fallback. All kernels give identical results.
+ */
+size_t pulse_widths (const uint8_t *samples, size_t count, pulse_state_t *state,
+                     uint32_t *widths, size_t max_widths);
+
+#endif /* PULSE_H */
@@ -0,0 +1,171 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tapewave.h"
+#include "tape.h"
+#include "pulse_list.h"
+
+/* Each bit is divided into quarters, as a '1' changes level every quarter-bit. */
+#define QUARTER_RATE    (BAUD_RATE * 4)
+
+
+/*
+ * Append 'samples' samples at 'level' to the list. Runs of the same level are merged.
+ */
+static int pulse_list_add (pulse_list_t *list, uint8_t level, uint64_t samples)
+{
+    if (samples == 0)
+    {
+        return 0;
+    }
+
+    if (list->count > 0 && list->pulses [list->count - 1].level == level)
+    {
+        list->pulses [list->count - 1].samples += samples;
+        list->samples += samples;
+        return 0;
+    }
+
+    if (list->count == list->size)
+    {
+        size_t size = (list->size == 0) ? 1024 : list->size * 2;
+        tapewave_pulse_t *pulses = realloc (list->pulses, size * sizeof (tapewave_pulse_t));
+        if (pulses == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        list->pulses = pulses;
+        list->size = size;
+    }
+
+    list->pulses [list->count].samples = samples;
+    list->pulses [list->count].level = level;
+    list->count++;
+    list->samples += samples;
+
+    return 0;
+}
+
+
+/*
+ * Append the pulses of a block to the list.
+ *
+ * Level changes fall on quarter-bit boundaries: a '0' is high for two quarters
+ * then low for two, and a '1' alternates every quarter. Quarter 'q' of the block
+ * starts at sample ceil (q * sample_rate / 4800), at the block's sample rate,
+ * matching wave_level ().
+ */
+static int pulse_list_add_block (pulse_list_t *list, const tape_block_t *block)
+{
+    uint32_t bits = tape_block_bits (block);
+    uint64_t position = 0;
+
+    for (uint32_t bit = 0; bit < bits; bit++)
+    {
+        uint32_t quarters_per_half = tape_block_bit (block, bit) ? 1 : 2;
+
+        for (uint32_t quarter = 0; quarter < 4; quarter += quarters_per_half)
+        {
+            uint64_t end_quarter = (uint64_t) bit * 4 + quarter + quarters_per_half;
+            uint64_t end = (end_quarter * block->sample_rate + QUARTER_RATE - 1) / QUARTER_RATE;
+            uint8_t level = ((quarter / quarters_per_half) & 1) ? WAVE_LOW : WAVE_HIGH;
+
+            if (pulse_list_add (list, level, end - position) < 0)
+            {
+                return -1;
+            }
+            position = end;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Build the list of pulses for a tape.
+ */
+int pulse_list_build (pulse_list_t *list, const tapewave_tape_t *tape)
+{
+    memset (list, 0, sizeof (pulse_list_t));
+
+    for (uint32_t i = 0; i < tape->section_count; i++)
+    {
+        const tape_section_t *section = &tape->sections [i];
+        int result;
+
+        if (section->is_block)
+        {
+            result = pulse_list_add_block (list, &section->block);
+        }
+        else
+        {
+            result = pulse_list_add (list, WAVE_SILENT, section->samples);
+        }
+
+        if (result < 0)
+        {
+            pulse_list_free (list);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Free the pulses held by a list.
+ */
+void pulse_list_free (pulse_list_t *list)
+{
+    free (list->pulses);
+    memset (list, 0, sizeof (pulse_list_t));
+}
+
+
+/*
+ * Get a tape as a list of pulses.
+ */
+tapewave_pulse_t *tapewave_tape_pulses (const tapewave_tape_t *tape, size_t *pulse_count)
+{
+    pulse_list_t list;
+
+    if (pulse_list_build (&list, tape) < 0)
+    {
+        return NULL;
+    }
+
+    *pulse_count = list.count;
+
+    return list.pulses;
+}
+
+
+/*
+ * Render a list of pulses as samples.
+ */
+size_t tapewave_render_pulses (const tapewave_pulse_t *pulses, size_t pulse_count, uint8_t *buffer)
+{
+    size_t rendered = 0;
+
+    for (size_t i = 0; i < pulse_count; i++)
+    {
+        memset (buffer + rendered, pulses [i].level, pulses [i].samples);
+        rendered += pulses [i].samples;
+    }
+
+    return rendered;
+}
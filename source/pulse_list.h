@@ -0,0 +1,36 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef PULSE_LIST_H
+#define PULSE_LIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tapewave.h"
+
+/* Growable list of pulses describing a tape. */
+typedef struct pulse_list_s {
+    tapewave_pulse_t *pulses;
+    size_t count;
+    size_t size;
+    uint64_t samples;       /* Total duration of the pulses */
+} pulse_list_t;
+
+
+/*
+ * Build the list of pulses for a tape, which must have been laid out with its program.
+ * Returns -1 with errno set on failure, in which case the list is left empty.
+ */
+int pulse_list_build (pulse_list_t *list, const tapewave_tape_t *tape);
+
+/*
+ * Free the pulses held by a list.
+ */
+void pulse_list_free (pulse_list_t *list);
+
+#endif /* PULSE_LIST_H */
@@ -0,0 +1,499 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tapewave.h"
+#include "tape.h"
+
+
+/*
+ * Calculate the number of samples in a specified length of silence.
+ */
+static uint64_t silent_ms_samples (uint32_t sample_rate, uint32_t length)
+{
+    return (uint64_t) length * sample_rate / 1000;
+}
+
+
+/*
+ * Append a section of silence to the tape. A zero-length silence is left out.
+ */
+static void tape_add_silence (tapewave_tape_t *tape, uint32_t length_ms)
+{
+    if (length_ms == 0)
+    {
+        return;
+    }
+
+    tape_section_t *section = &tape->sections [tape->section_count++];
+
+    section->start = tape->samples;
+    section->samples = silent_ms_samples (tape->sample_rate, length_ms);
+    section->length_ms = length_ms;
+    section->is_block = false;
+
+    tape->samples += section->samples;
+}
+
+
+/*
+ * Append a block to the tape, sent at 'speed' times the standard baud rate.
+ * The leader lasts as long as 'leader_bits' bits at the standard baud rate.
+ */
+static int tape_add_block (tapewave_tape_t *tape, uint8_t key_code, const uint8_t *data, uint32_t data_length,
+                           uint32_t leader_bits, uint32_t speed)
+{
+    tape_section_t *section = &tape->sections [tape->section_count++];
+    tape_block_t *block = &section->block;
+
+    block->speed = speed;
+    block->sample_rate = tape->sample_rate / speed;
+    block->wave_table = NULL;
+    block->leader_bits = leader_bits * speed;
+    block->key_code = key_code;
+    block->data = data;
+    block->data_length = data_length;
+    block->parity = 0;
+
+    /* The waveforms are shared, read-only, between all tapes */
+    if (data != NULL)
+    {
+        block->wave_table = wave_table_get (block->sample_rate);
+        if (block->wave_table == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    section->start = tape->samples;
+    section->samples = wave_bit_start (block->sample_rate, tape_block_bits (block));
+    section->is_block = true;
+
+    tape->samples += section->samples;
+
+    return 0;
+}
+
+
+/*
+ * Substitute the defaults for NULL options, and check that they are within the supported range.
+ */
+const tapewave_options_t *tape_options_check (const tapewave_options_t *options)
+{
+    static const tapewave_options_t default_options = {
+        .sample_rate = TAPEWAVE_DEFAULT_SAMPLE_RATE,
+        .threads = 1,
+        .turbo = 0,
+        .leader_bits = TAPEWAVE_STANDARD_LEADER_BITS,
+        .gap_ms = TAPEWAVE_STANDARD_GAP_MS,
+        .pad_ms = TAPEWAVE_STANDARD_PAD_MS,
+        .program_gap_ms = TAPEWAVE_DEFAULT_PROGRAM_GAP_MS
+    };
+
+    if (options == NULL)
+    {
+        return &default_options;
+    }
+
+    if (options->sample_rate < TAPEWAVE_MIN_SAMPLE_RATE || options->sample_rate > TAPEWAVE_MAX_SAMPLE_RATE ||
+        options->threads > TAPEWAVE_MAX_THREADS)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* A turbo block is rendered at a fraction of the sample rate, which must itself be supported */
+    if (options->turbo != 0 &&
+        (options->turbo < TAPEWAVE_MIN_TURBO || options->turbo > TAPEWAVE_MAX_TURBO ||
+         options->sample_rate % options->turbo != 0 ||
+         options->sample_rate / options->turbo < TAPEWAVE_MIN_TURBO_SAMPLE_RATE))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (options->leader_bits < TAPEWAVE_MIN_LEADER_BITS || options->leader_bits > TAPEWAVE_MAX_LEADER_BITS ||
+        options->gap_ms > TAPEWAVE_MAX_GAP_MS || options->pad_ms > TAPEWAVE_MAX_GAP_MS ||
+        options->program_gap_ms > TAPEWAVE_MAX_PROGRAM_GAP_MS)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return options;
+}
+
+
+/*
+ * Lay out a tape, without the program block's parity.
+ */
+int tape_layout (tapewave_tape_t *tape, const tapewave_options_t *options, const char *name,
+               const uint8_t *program, uint16_t program_length)
+{
+    memset (tape, 0, sizeof (tapewave_tape_t));
+    tape->sample_rate = options->sample_rate;
+
+    if (options->turbo != 0 && program_length > TAPEWAVE_TURBO_MAX_PROGRAM_LENGTH)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The file-name is padded with spaces */
+    if (name != NULL)
+    {
+        size_t name_length = strlen (name);
+        for (int i = 0; i < 16; i++)
+        {
+            tape->header_data [i] = (i < name_length) ? name [i] : ' ';
+        }
+    }
+
+    /* On a turbo tape, BASIC loads the loader in place of the program */
+    uint16_t basic_length = program_length;
+    if (options->turbo != 0)
+    {
+        basic_length = turbo_loader (tape->loader, program_length, options->turbo);
+    }
+
+    /* Program length */
+    /* TODO: Confirm byte order - In the scanned document, pencil and ink disagree. */
+    tape->header_data [16] = basic_length >> 8;
+    tape->header_data [17] = basic_length & 0xff;
+
+    tape_add_silence (tape, options->pad_ms);
+    tape_section_t *header_section = &tape->sections [tape->section_count];
+    if (tape_add_block (tape, 0x16, (program != NULL) ? tape->header_data : NULL, HEADER_DATA_LENGTH,
+                        options->leader_bits, 1) < 0)
+    {
+        return -1;
+    }
+    tape_add_silence (tape, options->gap_ms);
+
+    /* The loader is followed by the program, sent at the faster rate */
+    if (options->turbo != 0)
+    {
+        tape_section_t *loader_section = &tape->sections [tape->section_count];
+        if (tape_add_block (tape, 0x17, (program != NULL) ? tape->loader : NULL, basic_length,
+                            options->leader_bits, 1) < 0)
+        {
+            return -1;
+        }
+        tape_add_silence (tape, options->gap_ms);
+
+        loader_section->block.parity = -tape_checksum (tape->loader, basic_length);
+    }
+
+    tape->program_section = &tape->sections [tape->section_count];
+    if (tape_add_block (tape, 0x17, program, program_length, options->leader_bits,
+                        (options->turbo != 0) ? options->turbo : 1) < 0)
+    {
+        return -1;
+    }
+    tape_add_silence (tape, options->pad_ms);
+
+    /* The parity byte brings the sum of the data to zero */
+    header_section->block.parity = -tape_checksum (tape->header_data, HEADER_DATA_LENGTH);
+
+    return 0;
+}
+
+
+/*
+ * Lay out a tape.
+ */
+int tape_init (tapewave_tape_t *tape, const tapewave_options_t *options, const char *name,
+               const uint8_t *program, uint16_t program_length)
+{
+    if (tape_layout (tape, options, name, program, program_length) < 0)
+    {
+        return -1;
+    }
+
+    if (program != NULL)
+    {
+        tape->program_section->block.parity = -tape_checksum (program, program_length);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Lay out a tape holding several programs, without reading them.
+ */
+uint64_t tape_list_layout (const tapewave_options_t *options, const tapewave_entry_t *entries, uint32_t entry_count,
+                           uint64_t *starts)
+{
+    if (entry_count == 0)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    uint64_t gap_samples = silent_ms_samples (options->sample_rate, options->program_gap_ms);
+    uint64_t samples = 0;
+
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        tapewave_tape_t tape;
+        if (tape_init (&tape, options, NULL, NULL, entries [i].program_length) < 0)
+        {
+            return 0;
+        }
+
+        if (i > 0)
+        {
+            samples += gap_samples;
+        }
+        if (starts != NULL)
+        {
+            starts [i] = samples;
+        }
+        samples += tape.samples;
+    }
+
+    return samples;
+}
+
+
+/*
+ * Render 'count' samples of a block, starting from sample 'start' within the block.
+ */
+void tape_render_block (const tape_block_t *block, uint64_t start, uint64_t count, uint8_t *buffer)
+{
+    const wave_table_t *table = block->wave_table;
+
+    /* Find the bit containing the first sample, and how far into it the sample is */
+    uint64_t bit = start * BAUD_RATE / block->sample_rate;
+    uint32_t offset = start - wave_bit_start (block->sample_rate, bit);
+    uint32_t phase = bit % table->phases;
+
+    while (count > 0)
+    {
+        /* Whole bytes are copied from the byte waveforms, where available */
+        if (offset == 0 && table->byte_wave != NULL && bit >= block->leader_bits &&
+            (bit - block->leader_bits) % BYTE_BITS == 0 && count >= table->byte_length [phase])
+        {
+            uint8_t byte = tape_block_byte (block, (bit - block->leader_bits) / BYTE_BITS);
+            uint32_t length = table->byte_length [phase];
+
+            memcpy (buffer, wave_byte (table, phase, byte), length);
+            buffer += length;
+            count -= length;
+
+            bit += BYTE_BITS;
+            phase = (phase + BYTE_BITS) % table->phases;
+            continue;
+        }
+
+        /* Otherwise, copy one bit, or the part of it that is needed */
+        uint32_t length = table->bit_length [phase] - offset;
+        if (length > count)
+        {
+            length = count;
+        }
+
+        memcpy (buffer, wave_bit (table, phase, tape_block_bit (block, bit)) + offset, length);
+        buffer += length;
+        count -= length;
+        offset = 0;
+
+        bit++;
+        phase = (phase + 1 == table->phases) ? 0 : phase + 1;
+    }
+}
+
+
+/*
+ * Find the section containing sample 'n'.
+ */
+static const tape_section_t *tape_find_section (const tapewave_tape_t *tape, uint64_t n)
+{
+    for (uint32_t i = 0; i < tape->section_count; i++)
+    {
+        if (n < tape->sections [i].start + tape->sections [i].samples)
+        {
+            return &tape->sections [i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Create a tape for random access to its samples.
+ */
+tapewave_tape_t *tapewave_tape_create (const tapewave_options_t *options, const char *name,
+                                       const uint8_t *program, uint16_t program_length)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return NULL;
+    }
+
+    tapewave_tape_t *tape = malloc (sizeof (tapewave_tape_t));
+    if (tape == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (tape_init (tape, options, name, program, program_length) < 0)
+    {
+        free (tape);
+        return NULL;
+    }
+
+    return tape;
+}
+
+
+/*
+ * Get the layout of the tape for a program of the given length.
+ */
+int tapewave_tape_layout (const tapewave_options_t *options, uint16_t program_length,
+                          tapewave_section_t *sections, uint32_t max_sections)
+{
+    tapewave_tape_t tape;
+    if ((options = tape_options_check (options)) == NULL || tape_init (&tape, options, NULL, NULL, program_length) < 0)
+    {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < tape.section_count && i < max_sections; i++)
+    {
+        const tape_section_t *section = &tape.sections [i];
+        tapewave_section_t *info = &sections [i];
+
+        memset (info, 0, sizeof (tapewave_section_t));
+        info->start = section->start;
+        info->samples = section->samples;
+        info->is_block = section->is_block;
+
+        if (section->is_block)
+        {
+            const tape_block_t *block = &section->block;
+            uint32_t data_end_bit = block->leader_bits + (1 + block->data_length) * BYTE_BITS;
+
+            info->speed = block->speed;
+            info->key_code = block->key_code;
+            info->data_length = block->data_length;
+            info->leader_samples = wave_bit_start (block->sample_rate, block->leader_bits);
+            info->data_samples = wave_bit_start (block->sample_rate, data_end_bit) - info->leader_samples;
+            info->trailer_samples = section->samples - info->leader_samples - info->data_samples;
+        }
+    }
+
+    return tape.section_count;
+}
+
+
+/*
+ * Get the layout of a tape holding several programs.
+ */
+uint64_t tapewave_list_layout (const tapewave_options_t *options, const tapewave_entry_t *entries,
+                               uint32_t entry_count, uint64_t *starts)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return 0;
+    }
+
+    return tape_list_layout (options, entries, entry_count, starts);
+}
+
+
+/*
+ * Free a tape.
+ */
+void tapewave_tape_free (tapewave_tape_t *tape)
+{
+    free (tape);
+}
+
+
+/*
+ * Get the number of samples in a tape.
+ */
+uint64_t tapewave_tape_samples (const tapewave_tape_t *tape)
+{
+    return tape->samples;
+}
+
+
+/*
+ * Get the value of sample 'n'.
+ */
+uint8_t tapewave_sample_at (const tapewave_tape_t *tape, uint64_t n)
+{
+    const tape_section_t *section = tape_find_section (tape, n);
+
+    if (section == NULL || !section->is_block)
+    {
+        return WAVE_SILENT;
+    }
+
+    /* Find the bit containing the sample, and the sample's position within it */
+    const tape_block_t *block = &section->block;
+    uint64_t position = n - section->start;
+    uint64_t bit = position * BAUD_RATE / block->sample_rate;
+    uint64_t x = position * BAUD_RATE - bit * block->sample_rate;
+
+    return wave_level (block->sample_rate, x, tape_block_bit (block, bit));
+}
+
+
+/*
+ * Render a range of samples.
+ */
+size_t tapewave_render_range (const tapewave_tape_t *tape, uint64_t start, size_t count, uint8_t *buffer)
+{
+    if (start >= tape->samples)
+    {
+        return 0;
+    }
+    if (count > tape->samples - start)
+    {
+        count = tape->samples - start;
+    }
+
+    size_t rendered = 0;
+    const tape_section_t *section = tape_find_section (tape, start);
+
+    while (rendered < count)
+    {
+        uint64_t position = start + rendered - section->start;
+        uint64_t length = section->samples - position;
+        if (length > count - rendered)
+        {
+            length = count - rendered;
+        }
+
+        if (section->is_block)
+        {
+            tape_render_block (&section->block, position, length, buffer + rendered);
+        }
+        else
+        {
+            memset (buffer + rendered, WAVE_SILENT, length);
+        }
+
+        rendered += length;
+        section++;
+    }
+
+    return rendered;
+}
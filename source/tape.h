@@ -0,0 +1,184 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tapewave.h"
+#include "wave_table.h"
+#include "turbo.h"
+
+/* Header block data: file-name, and program length. */
+#define HEADER_DATA_LENGTH  (16 + 2)
+
+/* Bytes in a block besides its data: key-code, parity, and two dummy bytes. */
+#define BLOCK_EXTRA_BYTES   4
+
+#define TAPE_MAX_SECTIONS   7
+
+/*
+ * A block of bytes: a leader field, then the key-code, data, parity byte,
+ * and two dummy bytes. The parity byte covers the data only.
+ *
+ * A turbo block is sent 'speed' times faster, which at the tape's sample rate
+ * is the same waveform as a standard block at 1/speed of the sample rate.
+ */
+typedef struct tape_block_s {
+    uint32_t speed;
+    uint32_t sample_rate;           /* The tape's sample rate, divided by the speed */
+    const wave_table_t *wave_table; /* Waveforms at the block's sample rate */
+
+    uint32_t leader_bits;
+    uint8_t key_code;
+    const uint8_t *data;
+    uint32_t data_length;
+    uint8_t parity;
+} tape_block_t;
+
+/* A section of the tape, either silence or a block. */
+typedef struct tape_section_s {
+    uint64_t start;         /* First sample of the section */
+    uint64_t samples;       /* Length of the section in samples */
+    uint32_t length_ms;     /* Length of a silent section in milliseconds */
+    bool is_block;
+    tape_block_t block;
+} tape_section_t;
+
+/*
+ * Layout of a complete tape. Every section has a fixed length that depends only
+ * on the program length and sample rate, so the position of any sample is known
+ * without rendering what comes before it.
+ */
+struct tapewave_tape_s {
+    uint32_t sample_rate;
+
+    uint8_t header_data [HEADER_DATA_LENGTH];
+    uint8_t loader [TURBO_LOADER_SIZE];
+
+    tape_section_t sections [TAPE_MAX_SECTIONS];
+    uint32_t section_count;
+    uint64_t samples;
+
+    /* Section holding the program block, which is the turbo block on a turbo tape */
+    tape_section_t *program_section;
+};
+
+
+/*
+ * Substitute the defaults for NULL options, and check that they are within the supported range.
+ * Returns NULL with errno set to EINVAL if they are not.
+ */
+const tapewave_options_t *tape_options_check (const tapewave_options_t *options);
+
+/*
+ * Lay out a tape, with options that have already been checked. If 'program'
+ * is NULL, only the section lengths are valid, and the tape cannot be rendered.
+ * Returns -1 with errno set on failure.
+ */
+int tape_init (tapewave_tape_t *tape, const tapewave_options_t *options, const char *name,
+               const uint8_t *program, uint16_t program_length);
+
+/*
+ * As tape_init, but leaves the program block's parity byte for the caller to fill in.
+ */
+int tape_layout (tapewave_tape_t *tape, const tapewave_options_t *options, const char *name,
+                 const uint8_t *program, uint16_t program_length);
+
+/*
+ * Lay out a tape holding several programs, with options that have already been
+ * checked. Only the program lengths are read. If 'starts' is not NULL, the first
+ * sample of each program's tape is written to it. Returns the total number of
+ * samples, or 0 with errno set on failure.
+ */
+uint64_t tape_list_layout (const tapewave_options_t *options, const tapewave_entry_t *entries, uint32_t entry_count,
+                           uint64_t *starts);
+
+/*
+ * Get byte 'index' of a block, counting the key-code as byte 0.
+ */
+static inline uint8_t tape_block_byte (const tape_block_t *block, uint32_t index)
+{
+    if (index == 0)
+    {
+        return block->key_code;
+    }
+    else if (index <= block->data_length)
+    {
+        return block->data [index - 1];
+    }
+    else if (index == block->data_length + 1)
+    {
+        return block->parity;
+    }
+
+    return 0x00;
+}
+
+/*
+ * Get bit 'index' of a block, counting the first bit of the leader field as bit 0.
+ */
+static inline bool tape_block_bit (const tape_block_t *block, uint64_t index)
+{
+    if (index < block->leader_bits)
+    {
+        return 1;
+    }
+
+    /* Start bit, data bits, and two stop bits */
+    uint32_t byte_index = (index - block->leader_bits) / BYTE_BITS;
+    uint32_t frame = 0x600 | (tape_block_byte (block, byte_index) << 1);
+
+    return (frame >> ((index - block->leader_bits) % BYTE_BITS)) & 1;
+}
+
+/*
+ * Get the number of bits in a block, including its leader field.
+ */
+static inline uint32_t tape_block_bits (const tape_block_t *block)
+{
+    return block->leader_bits + (block->data_length + BLOCK_EXTRA_BYTES) * BYTE_BITS;
+}
+
+/*
+ * Sum a run of data bytes. The parity byte of a block is the negative of the sum of its data.
+ */
+static inline uint8_t tape_checksum (const uint8_t *data, uint32_t length)
+{
+    uint8_t checksum = 0;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        checksum += data [i];
+    }
+
+    return checksum;
+}
+
+/*
+ * Get the range of samples, within the tape holding 'section', taken up by 'count'
+ * bytes of its block's data, starting from data byte 'index'. Data byte
+ * 'data_length' is the parity byte.
+ */
+static inline void tape_data_samples (const tape_section_t *section, uint32_t index, uint32_t count,
+                                      uint64_t *start, uint64_t *samples)
+{
+    /* Data byte 0 follows the leader field and the key-code */
+    uint64_t first_bit = section->block.leader_bits + (1 + index) * BYTE_BITS;
+
+    *start = section->start + wave_bit_start (section->block.sample_rate, first_bit);
+    *samples = section->start + wave_bit_start (section->block.sample_rate, first_bit + count * BYTE_BITS) - *start;
+}
+
+/*
+ * Render 'count' samples of a block, starting from sample 'start' within the block.
+ */
+void tape_render_block (const tape_block_t *block, uint64_t start, uint64_t count, uint8_t *buffer);
+
+#endif /* TAPE_H */
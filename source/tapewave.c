@@ -0,0 +1,886 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "tapewave.h"
+#include "wave_table.h"
+#include "tape.h"
+#include "flac.h"
+#include "tzx.h"
+
+/* A slice of a tape, rendered by its own thread. */
+typedef struct render_slice_s {
+    const tapewave_tape_t *tape;
+    uint64_t start;
+    uint64_t samples;
+    uint8_t *buffer;
+
+    /* Program bytes within the slice, summed for the parity byte */
+    const uint8_t *data;
+    uint32_t data_length;
+    uint8_t checksum;
+} render_slice_t;
+
+/* When patching, runs of changed bytes closer together than this are merged into one write. */
+#define PATCH_MERGE_DISTANCE    16
+
+/*
+ * Pass any buffered data to the sink.
+ */
+static void output_flush (tapewave_encoder_t *encoder)
+{
+    if (encoder->output_buffer_used > 0 && !encoder->output_failed)
+    {
+        if (encoder->sink (encoder->sink_context, encoder->output_buffer, encoder->output_buffer_used) < 0)
+        {
+            encoder->output_failed = true;
+            encoder->output_errno = errno;
+        }
+    }
+
+    encoder->output_buffer_used = 0;
+}
+
+
+/*
+ * Reserve space for 'length' samples in the output buffer.
+ * The returned pointer is valid until the next call.
+ */
+static uint8_t *output_reserve (tapewave_encoder_t *encoder, uint32_t length)
+{
+    if (encoder->output_buffer_used + length > encoder->output_buffer_size)
+    {
+        output_flush (encoder);
+    }
+
+    uint8_t *samples = encoder->output_buffer + encoder->output_buffer_used;
+    encoder->output_buffer_used += length;
+
+    return samples;
+}
+
+
+/*
+ * Copy 'length' bytes of data into the output buffer.
+ * Data larger than the buffer is passed through in pieces.
+ */
+static void output_write (tapewave_encoder_t *encoder, const void *data, uint32_t length)
+{
+    const uint8_t *bytes = data;
+
+    while (length > 0)
+    {
+        uint32_t chunk = (length < encoder->output_buffer_size) ? length : encoder->output_buffer_size;
+
+        memcpy (output_reserve (encoder, chunk), bytes, chunk);
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+
+/*
+ * Write 'samples' samples of silence to the wave file.
+ */
+static void write_silence (tapewave_encoder_t *encoder, uint64_t samples)
+{
+    while (samples > 0)
+    {
+        uint64_t chunk = (samples < encoder->output_buffer_size) ? samples : encoder->output_buffer_size;
+
+        memset (output_reserve (encoder, chunk), WAVE_SILENT, chunk);
+        samples -= chunk;
+    }
+}
+
+
+/*
+ * Write the tape to the wave file.
+ */
+static void write_tape (tapewave_encoder_t *encoder, const tapewave_tape_t *tape)
+{
+    for (uint32_t i = 0; i < tape->section_count; i++)
+    {
+        const tape_section_t *section = &tape->sections [i];
+        uint64_t position = 0;
+
+        /* Render each section in pieces that fit in the output buffer */
+        while (position < section->samples)
+        {
+            uint64_t chunk = section->samples - position;
+            if (chunk > encoder->output_buffer_size)
+            {
+                chunk = encoder->output_buffer_size;
+            }
+
+            uint8_t *samples = output_reserve (encoder, chunk);
+            if (section->is_block)
+            {
+                tape_render_block (&section->block, position, chunk, samples);
+            }
+            else
+            {
+                memset (samples, WAVE_SILENT, chunk);
+            }
+
+            position += chunk;
+        }
+    }
+}
+
+
+/*
+ * Write the RIFF header for a tape of 'data_size' samples.
+ *
+ * Note that we assume a little-endian host.
+ */
+static void write_wav_header (tapewave_encoder_t *encoder, uint32_t sample_rate, uint32_t data_size)
+{
+    const uint32_t format_length            = 16;       /* Length of the format section in bytes */
+    const uint16_t format_type              = 1;        /* PCM */
+    const uint16_t format_channels          = 1;        /* Mono */
+    const uint32_t format_sample_rate       = sample_rate;
+    const uint32_t format_byte_rate         = sample_rate;      /* One byte per frame */
+    const uint16_t format_block_align       = 1;        /* Frames are one-byte aligned */
+    const uint16_t format_bits_per_sample   = 8;        /* 8-bit */
+
+    /* 'riff_size' and 'data_size' store the number of bytes still to come,
+     * counting from the first byte that comes after the size field itself. */
+    uint32_t riff_size = TAPEWAVE_WAV_HEADER_SIZE + data_size - 8;
+
+    /* Write RIFF header */
+    output_write (encoder, "RIFF", 4);
+    output_write (encoder, &riff_size, 4);
+    output_write (encoder, "WAVE", 4);
+
+    /* Write WAVE format */
+    output_write (encoder, "fmt ", 4);
+    output_write (encoder, &format_length, 4);
+    output_write (encoder, &format_type, 2);
+    output_write (encoder, &format_channels, 2);
+    output_write (encoder, &format_sample_rate, 4);
+    output_write (encoder, &format_byte_rate, 4);
+    output_write (encoder, &format_block_align, 2);
+    output_write (encoder, &format_bits_per_sample, 2);
+
+    /* Write WAVE data */
+    output_write (encoder, "data", 4);
+    output_write (encoder, &data_size, 4);
+}
+
+
+/*
+ * Sink to write data to a file descriptor.
+ */
+static int fd_sink (void *context, const uint8_t *data, size_t length)
+{
+    int fd = *(int *) context;
+    size_t bytes_written = 0;
+
+    while (bytes_written < length)
+    {
+        ssize_t result = write (fd, data + bytes_written, length - bytes_written);
+
+        if (result >= 0)
+        {
+            bytes_written += result;
+        }
+        else if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Render the wave file for a list of programs, once the encoder's output has been
+ * set up. The tapes are laid out one at a time, so only one is held at once.
+ */
+static int encode (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                   const tapewave_entry_t *entries, uint32_t entry_count)
+{
+    uint64_t samples = tape_list_layout (options, entries, entry_count, NULL);
+    if (samples == 0)
+    {
+        return -1;
+    }
+    if (samples > UINT32_MAX - TAPEWAVE_WAV_HEADER_SIZE)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    encoder->output_buffer_used = 0;
+    encoder->output_failed = false;
+    encoder->output_errno = 0;
+
+    write_wav_header (encoder, options->sample_rate, samples);
+
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        tapewave_tape_t tape;
+        if (tape_init (&tape, options, entries [i].name, entries [i].program, entries [i].program_length) < 0)
+        {
+            return -1;
+        }
+
+        if (i > 0)
+        {
+            write_silence (encoder, (uint64_t) options->program_gap_ms * options->sample_rate / 1000);
+        }
+        write_tape (encoder, &tape);
+    }
+
+    if (encoder->sink != NULL)
+    {
+        output_flush (encoder);
+    }
+
+    if (encoder->output_failed)
+    {
+        errno = encoder->output_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Render a program as a FLAC file, in frames of FLAC_BLOCK_SIZE samples.
+ */
+static int encode_flac (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                        const char *name, const uint8_t *program, uint16_t program_length)
+{
+    tapewave_tape_t tape;
+    if (tape_init (&tape, options, name, program, program_length) < 0)
+    {
+        return -1;
+    }
+
+    encoder->output_buffer_used = 0;
+    encoder->output_failed = false;
+    encoder->output_errno = 0;
+
+    flac_stream_header (output_reserve (encoder, FLAC_STREAM_HEADER_SIZE), tape.sample_rate, tape.samples);
+
+    uint8_t samples [FLAC_BLOCK_SIZE];
+    uint32_t frame_number = 0;
+    for (uint64_t position = 0; position < tape.samples; position += FLAC_BLOCK_SIZE)
+    {
+        size_t count = tapewave_render_range (&tape, position, FLAC_BLOCK_SIZE, samples);
+
+        /* Reserve space for the largest possible frame, then give back what was not used */
+        uint8_t *frame = output_reserve (encoder, FLAC_MAX_FRAME_SIZE);
+        size_t frame_size = flac_encode_frame (samples, count, frame_number++, tape.sample_rate, frame);
+        encoder->output_buffer_used -= FLAC_MAX_FRAME_SIZE - frame_size;
+    }
+
+    output_flush (encoder);
+
+    if (encoder->output_failed)
+    {
+        errno = encoder->output_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Write a program as a TZX tape image. Each block becomes a generalised data
+ * block, and silence that follows a block becomes that block's pause.
+ */
+static int encode_tzx (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                       const char *name, const uint8_t *program, uint16_t program_length)
+{
+    tapewave_tape_t tape;
+    if (tape_init (&tape, options, name, program, program_length) < 0)
+    {
+        return -1;
+    }
+
+    encoder->output_buffer_used = 0;
+    encoder->output_failed = false;
+    encoder->output_errno = 0;
+
+    uint8_t preamble [TZX_PREAMBLE_MAX_SIZE];
+    output_write (encoder, preamble, tzx_preamble (preamble, tape.header_data));
+
+    for (uint32_t i = 0; i < tape.section_count; i++)
+    {
+        const tape_section_t *section = &tape.sections [i];
+
+        if (!section->is_block)
+        {
+            uint8_t pause [TZX_PAUSE_SIZE];
+            tzx_pause (pause, section->length_ms);
+            output_write (encoder, pause, TZX_PAUSE_SIZE);
+            continue;
+        }
+
+        uint32_t pause_ms = 0;
+        if (i + 1 < tape.section_count && !tape.sections [i + 1].is_block)
+        {
+            pause_ms = tape.sections [++i].length_ms;
+        }
+
+        size_t block_size = tzx_block_size (&section->block);
+        uint8_t *block = malloc (block_size);
+        if (block == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        tzx_block (block, &section->block, pause_ms);
+        output_write (encoder, block, block_size);
+        free (block);
+    }
+
+    output_flush (encoder);
+
+    if (encoder->output_failed)
+    {
+        errno = encoder->output_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Render one slice of a tape, and sum the program bytes it holds.
+ */
+static void *render_slice (void *arg)
+{
+    render_slice_t *slice = arg;
+
+    tapewave_render_range (slice->tape, slice->start, slice->samples, slice->buffer);
+    slice->checksum = tape_checksum (slice->data, slice->data_length);
+
+    return NULL;
+}
+
+
+/*
+ * Render a complete wave file into a buffer, using several threads. Each byte of the program
+ * has a fixed position in the output, so the program is split into slices that are rendered
+ * independently. Only the parity byte depends on the whole program, so it is rendered last,
+ * from the sum of the checksums of each slice.
+ */
+static int encode_parallel (const tapewave_options_t *options, const char *name,
+                            const uint8_t *program, uint16_t program_length, uint8_t *buffer)
+{
+    tapewave_tape_t tape;
+    if (tape_layout (&tape, options, name, program, program_length) < 0)
+    {
+        return -1;
+    }
+
+    /* The buffer has already been checked to be large enough for the whole file */
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+    encoder.output_buffer = buffer;
+    encoder.output_buffer_size = TAPEWAVE_WAV_HEADER_SIZE;
+    write_wav_header (&encoder, tape.sample_rate, tape.samples);
+    uint8_t *samples = buffer + TAPEWAVE_WAV_HEADER_SIZE;
+
+    uint32_t slice_count = options->threads;
+    if (slice_count > program_length)
+    {
+        slice_count = (program_length > 0) ? program_length : 1;
+    }
+
+    render_slice_t slices [TAPEWAVE_MAX_THREADS];
+    pthread_t threads [TAPEWAVE_MAX_THREADS];
+    bool thread_started [TAPEWAVE_MAX_THREADS] = { false };
+
+    /* Slices end on byte boundaries. The first also covers everything before the program data. */
+    const tape_section_t *section = tape.program_section;
+    uint64_t slice_start = 0;
+    for (uint32_t i = 0; i < slice_count; i++)
+    {
+        uint32_t first_byte = (uint64_t) program_length * i / slice_count;
+        uint32_t end_byte = (uint64_t) program_length * (i + 1) / slice_count;
+        uint64_t data_start;
+        uint64_t data_samples;
+        tape_data_samples (section, first_byte, end_byte - first_byte, &data_start, &data_samples);
+
+        slices [i].tape = &tape;
+        slices [i].start = slice_start;
+        slices [i].samples = data_start + data_samples - slice_start;
+        slices [i].buffer = samples + slice_start;
+        slices [i].data = program + first_byte;
+        slices [i].data_length = end_byte - first_byte;
+
+        slice_start += slices [i].samples;
+    }
+
+    /* The calling thread renders the first slice itself, and any slice that a thread could not be started for */
+    for (uint32_t i = 1; i < slice_count; i++)
+    {
+        thread_started [i] = (pthread_create (&threads [i], NULL, render_slice, &slices [i]) == 0);
+    }
+    for (uint32_t i = 0; i < slice_count; i++)
+    {
+        if (!thread_started [i])
+        {
+            render_slice (&slices [i]);
+        }
+    }
+
+    uint8_t checksum = 0;
+    for (uint32_t i = 0; i < slice_count; i++)
+    {
+        if (thread_started [i])
+        {
+            pthread_join (threads [i], NULL);
+        }
+        checksum += slices [i].checksum;
+    }
+
+    /* With the parity known, render the rest of the tape */
+    tape.program_section->block.parity = -checksum;
+    tapewave_render_range (&tape, slice_start, tape.samples - slice_start, samples + slice_start);
+
+    return 0;
+}
+
+
+/*
+ * Point the encoder's output at its own storage, growing it to at least 'size' bytes.
+ */
+static int use_storage (tapewave_encoder_t *encoder, uint32_t size)
+{
+    if (encoder->storage_size < size)
+    {
+        uint8_t *storage = realloc (encoder->storage, size);
+        if (storage == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        encoder->storage = storage;
+        encoder->storage_size = size;
+    }
+
+    encoder->output_buffer = encoder->storage;
+    encoder->output_buffer_size = size;
+
+    return 0;
+}
+
+
+/*
+ * Set the options to their defaults.
+ */
+void tapewave_options_init (tapewave_options_t *options)
+{
+    options->sample_rate = TAPEWAVE_DEFAULT_SAMPLE_RATE;
+    options->threads = 1;
+    options->turbo = 0;
+    options->leader_bits = TAPEWAVE_STANDARD_LEADER_BITS;
+    options->gap_ms = TAPEWAVE_STANDARD_GAP_MS;
+    options->pad_ms = TAPEWAVE_STANDARD_PAD_MS;
+    options->program_gap_ms = TAPEWAVE_DEFAULT_PROGRAM_GAP_MS;
+}
+
+
+/*
+ * Initialise an encoder.
+ */
+void tapewave_encoder_init (tapewave_encoder_t *encoder)
+{
+    memset (encoder, 0, sizeof (tapewave_encoder_t));
+}
+
+
+/*
+ * Free the memory held by an encoder.
+ */
+void tapewave_encoder_free (tapewave_encoder_t *encoder)
+{
+    free (encoder->storage);
+    tapewave_encoder_init (encoder);
+}
+
+
+/*
+ * Calculate the size in bytes of the wave file for a program of the given length.
+ */
+uint32_t tapewave_wav_size (const tapewave_options_t *options, uint16_t program_length)
+{
+    tapewave_tape_t tape;
+    if ((options = tape_options_check (options)) == NULL || tape_init (&tape, options, NULL, NULL, program_length) < 0)
+    {
+        return 0;
+    }
+
+    return TAPEWAVE_WAV_HEADER_SIZE + tape.samples;
+}
+
+
+/*
+ * Render a program as a complete wave file, passed to 'sink' in spans.
+ */
+int tapewave_encode_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                             const uint8_t *program, uint16_t program_length,
+                             tapewave_sink_t sink, void *sink_context)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    if (use_storage (encoder, TAPEWAVE_STREAM_BUFFER_SIZE) < 0)
+    {
+        return -1;
+    }
+
+    encoder->sink = sink;
+    encoder->sink_context = sink_context;
+
+    tapewave_entry_t entry = { .name = name, .program = program, .program_length = program_length };
+    return encode (encoder, options, &entry, 1);
+}
+
+
+/*
+ * Render a program as a complete wave file, written to the file descriptor 'fd'.
+ */
+int tapewave_encode (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                     const uint8_t *program, uint16_t program_length, int fd, bool stream)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    /* Size the buffer to hold the entire output file, or when streaming,
+     * use a smaller buffer to be flushed down the pipe as it fills. */
+    if (use_storage (encoder, stream ? TAPEWAVE_STREAM_BUFFER_SIZE : tapewave_wav_size (options, program_length)) < 0)
+    {
+        return -1;
+    }
+
+    encoder->sink = fd_sink;
+    encoder->sink_context = &fd;
+
+    /* Unless streaming, the buffer holds the whole file, so this is a single write */
+    tapewave_entry_t entry = { .name = name, .program = program, .program_length = program_length };
+    return encode (encoder, options, &entry, 1);
+}
+
+
+/*
+ * Render a program as a complete wave file, into a caller-supplied buffer.
+ */
+int tapewave_encode_to_buffer (const tapewave_options_t *options, const char *name,
+                               const uint8_t *program, uint16_t program_length,
+                               uint8_t *buffer, size_t buffer_size)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    if (buffer_size < tapewave_wav_size (options, program_length))
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (options->threads > 1)
+    {
+        return encode_parallel (options, name, program, program_length, buffer);
+    }
+
+    tapewave_encoder_t encoder;
+    tapewave_encoder_init (&encoder);
+
+    /* The buffer is large enough to hold the whole file, so is never flushed */
+    encoder.output_buffer = buffer;
+    encoder.output_buffer_size = buffer_size;
+
+    tapewave_entry_t entry = { .name = name, .program = program, .program_length = program_length };
+    return encode (&encoder, options, &entry, 1);
+}
+
+
+/*
+ * Render a program as a complete wave file, directly into a memory-mapping of 'fd'.
+ */
+int tapewave_encode_to_mmap (const tapewave_options_t *options, const char *name,
+                             const uint8_t *program, uint16_t program_length, int fd)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    /* The file's final size is known before rendering, so it can be sized up front.
+     * A size of 0 means the program cannot be laid out, and the file is left as it is. */
+    uint32_t wav_size = tapewave_wav_size (options, program_length);
+    if (wav_size == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ftruncate (fd, wav_size) < 0)
+    {
+        return -1;
+    }
+
+    uint8_t *wav = mmap (NULL, wav_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (wav == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    int result = tapewave_encode_to_buffer (options, name, program, program_length, wav, wav_size);
+    int encode_errno = errno;
+
+    if (munmap (wav, wav_size) < 0 && result == 0)
+    {
+        return -1;
+    }
+
+    errno = encode_errno;
+    return result;
+}
+
+
+/*
+ * Render a program as a FLAC file, passed to 'sink' in spans.
+ */
+int tapewave_encode_flac_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                                  const uint8_t *program, uint16_t program_length,
+                                  tapewave_sink_t sink, void *sink_context)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    if (use_storage (encoder, TAPEWAVE_STREAM_BUFFER_SIZE) < 0)
+    {
+        return -1;
+    }
+
+    encoder->sink = sink;
+    encoder->sink_context = sink_context;
+
+    return encode_flac (encoder, options, name, program, program_length);
+}
+
+
+/*
+ * Render a program as a FLAC file, written to the file descriptor 'fd'.
+ */
+int tapewave_encode_flac (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                          const uint8_t *program, uint16_t program_length, int fd)
+{
+    return tapewave_encode_flac_to_sink (encoder, options, name, program, program_length, fd_sink, &fd);
+}
+
+
+/*
+ * Write a program as a TZX tape image, passed to 'sink' in spans.
+ */
+int tapewave_encode_tzx_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                                 const uint8_t *program, uint16_t program_length,
+                                 tapewave_sink_t sink, void *sink_context)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    if (use_storage (encoder, TAPEWAVE_STREAM_BUFFER_SIZE) < 0)
+    {
+        return -1;
+    }
+
+    encoder->sink = sink;
+    encoder->sink_context = sink_context;
+
+    return encode_tzx (encoder, options, name, program, program_length);
+}
+
+
+/*
+ * Write a program as a TZX tape image, to the file descriptor 'fd'.
+ */
+int tapewave_encode_tzx (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                         const uint8_t *program, uint16_t program_length, int fd)
+{
+    return tapewave_encode_tzx_to_sink (encoder, options, name, program, program_length, fd_sink, &fd);
+}
+
+
+/*
+ * Render several programs as a single wave file, passed to 'sink' in spans.
+ */
+int tapewave_encode_list_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                                  const tapewave_entry_t *entries, uint32_t entry_count,
+                                  tapewave_sink_t sink, void *sink_context)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    if (use_storage (encoder, TAPEWAVE_STREAM_BUFFER_SIZE) < 0)
+    {
+        return -1;
+    }
+
+    encoder->sink = sink;
+    encoder->sink_context = sink_context;
+
+    return encode (encoder, options, entries, entry_count);
+}
+
+
+/*
+ * Render several programs as a single wave file, written to the file descriptor 'fd'.
+ */
+int tapewave_encode_list (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                          const tapewave_entry_t *entries, uint32_t entry_count, int fd)
+{
+    return tapewave_encode_list_to_sink (encoder, options, entries, entry_count, fd_sink, &fd);
+}
+
+
+/*
+ * Render a range of samples, and write them at the matching position in the wave file.
+ */
+static int patch_range (const tapewave_tape_t *tape, uint64_t start, uint64_t samples, int fd, uint8_t *buffer)
+{
+    while (samples > 0)
+    {
+        size_t chunk = (samples < TAPEWAVE_STREAM_BUFFER_SIZE) ? samples : TAPEWAVE_STREAM_BUFFER_SIZE;
+        size_t bytes_written = 0;
+
+        tapewave_render_range (tape, start, chunk, buffer);
+
+        while (bytes_written < chunk)
+        {
+            ssize_t result = pwrite (fd, buffer + bytes_written, chunk - bytes_written,
+                                     TAPEWAVE_WAV_HEADER_SIZE + start + bytes_written);
+            if (result >= 0)
+            {
+                bytes_written += result;
+            }
+            else if (errno != EINTR)
+            {
+                return -1;
+            }
+        }
+
+        start += chunk;
+        samples -= chunk;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Update a wave file rendered from 'old_program' so that it holds 'program' instead.
+ */
+int tapewave_patch (const tapewave_options_t *options, const char *name, const uint8_t *old_program,
+                    const uint8_t *program, uint16_t program_length, int fd)
+{
+    if ((options = tape_options_check (options)) == NULL)
+    {
+        return -1;
+    }
+
+    tapewave_tape_t tape;
+    tapewave_tape_t old_tape;
+    if (tape_init (&tape, options, name, program, program_length) < 0 ||
+        tape_init (&old_tape, options, name, old_program, program_length) < 0)
+    {
+        return -1;
+    }
+
+    uint8_t *buffer = malloc (TAPEWAVE_STREAM_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    const tape_section_t *section = tape.program_section;
+    uint32_t changed_bytes = 0;
+    uint32_t i = 0;
+    int result = 0;
+
+    while (i < program_length && result == 0)
+    {
+        if (program [i] == old_program [i])
+        {
+            i++;
+            continue;
+        }
+
+        /* Find the end of this run of changes. Nearby runs are merged, as
+         * one larger write is cheaper than several small ones. */
+        uint32_t run_start = i;
+        uint32_t run_end = i + 1;
+        for (uint32_t j = run_end; j < program_length && j < run_end + PATCH_MERGE_DISTANCE; j++)
+        {
+            if (program [j] != old_program [j])
+            {
+                run_end = j + 1;
+            }
+        }
+
+        for (uint32_t j = run_start; j < run_end; j++)
+        {
+            changed_bytes += (program [j] != old_program [j]);
+        }
+
+        uint64_t start;
+        uint64_t samples;
+        tape_data_samples (section, run_start, run_end - run_start, &start, &samples);
+        result = patch_range (&tape, start, samples, fd, buffer);
+
+        i = run_end;
+    }
+
+    /* The parity byte follows the program */
+    if (result == 0 && section->block.parity != old_tape.program_section->block.parity)
+    {
+        uint64_t start;
+        uint64_t samples;
+        tape_data_samples (section, program_length, 1, &start, &samples);
+        result = patch_range (&tape, start, samples, fd, buffer);
+    }
+
+    free (buffer);
+
+    return (result < 0) ? -1 : (int) changed_bytes;
+}
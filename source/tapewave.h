@@ -0,0 +1,428 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef TAPEWAVE_H
+#define TAPEWAVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TAPEWAVE_WAV_HEADER_SIZE        44
+#define TAPEWAVE_MAX_PROGRAM_LENGTH     65535
+
+/* Buffer size when streaming to a pipe, where the output is flushed as it fills. */
+#define TAPEWAVE_STREAM_BUFFER_SIZE     65536
+
+/* 9.6 kHz gives exactly 8 samples per tape-bit. Other rates use fractional timing. */
+#define TAPEWAVE_DEFAULT_SAMPLE_RATE    9600
+#define TAPEWAVE_MIN_SAMPLE_RATE        8000
+#define TAPEWAVE_MAX_SAMPLE_RATE        192000
+
+/* Limit on the threads used to render a single tape. */
+#define TAPEWAVE_MAX_THREADS            64
+
+/* Range of speed-ups for turbo tapes. The sample rate must be a multiple of the
+ * speed-up, of at least TAPEWAVE_MIN_TURBO_SAMPLE_RATE times it. With fewer than
+ * 8 samples per bit, the edges jitter too far for the loader at the higher speeds. */
+#define TAPEWAVE_MIN_TURBO              2
+#define TAPEWAVE_MAX_TURBO              6
+#define TAPEWAVE_MIN_TURBO_SAMPLE_RATE  9600
+
+/* Longest program for a turbo tape. The program is loaded to 0x9800, followed
+ * by the loader, and both must fit below 0xf000. */
+#define TAPEWAVE_TURBO_MAX_PROGRAM_LENGTH   22272
+
+/* Standard timing, as written by the SC-3000: a leader field of '1' bits before
+ * each block, a gap between the blocks, and a pad of silence at either end. */
+#define TAPEWAVE_STANDARD_LEADER_BITS   3600
+#define TAPEWAVE_STANDARD_GAP_MS        1000
+#define TAPEWAVE_STANDARD_PAD_MS        10
+
+/* Minimal timing. The leaders are cut to 0.6 s, which leaves a margin over the
+ * few hundred bits needed to lock on to them, and the gap to 0.2 s, for BASIC
+ * to show the file-name before the program block's leader ends. */
+#define TAPEWAVE_MINIMAL_LEADER_BITS    720
+#define TAPEWAVE_MINIMAL_GAP_MS         200
+#define TAPEWAVE_MINIMAL_PAD_MS         0
+
+/* Limits of a custom timing. Shorter leaders are not recognised by the decoder. */
+#define TAPEWAVE_MIN_LEADER_BITS        200
+#define TAPEWAVE_MAX_LEADER_BITS        10000
+#define TAPEWAVE_MAX_GAP_MS             10000
+
+/* Silence between the programs on a tape holding several, and its limit. */
+#define TAPEWAVE_DEFAULT_PROGRAM_GAP_MS 2000
+#define TAPEWAVE_MAX_PROGRAM_GAP_MS     60000
+
+/*
+ * Options for rendering a tape. Where NULL is passed, the defaults are used.
+ *
+ * A turbo tape holds a machine-code loader in place of the program, which BASIC
+ * loads as usual, to be started with CALL &H9800. The loader then reads the
+ * program from a further block, sent 'turbo' times faster than the standard
+ * blocks, loads it to 0x9800, and runs it if its parity byte is correct.
+ */
+typedef struct tapewave_options_s {
+    uint32_t sample_rate;
+    uint32_t threads;       /* Threads to render with, when writing to a buffer or memory-mapping */
+    uint32_t turbo;         /* If non-zero, the program is sent this many times faster, for a machine-code loader */
+
+    /* Timing, which defaults to the standard values */
+    uint32_t leader_bits;   /* Length of the leader field before each block, in 1200 baud bits */
+    uint32_t gap_ms;        /* Silence between blocks */
+    uint32_t pad_ms;        /* Silence at the start and end of the tape */
+
+    /* Silence between programs, on a tape holding several */
+    uint32_t program_gap_ms;
+} tapewave_options_t;
+
+/*
+ * One program of a tape holding several. Each program is laid out as a tape of
+ * its own, with its own pads, and the tapes follow one another, separated by
+ * options->program_gap_ms of silence.
+ */
+typedef struct tapewave_entry_s {
+    const char *name;
+    const uint8_t *program;
+    uint16_t program_length;
+} tapewave_entry_t;
+
+/*
+ * Callback to receive rendered data. The wave file is passed to the sink in
+ * order, as a series of spans, starting with the header. The data is only
+ * valid for the duration of the call. Returns 0 on success, or -1 with
+ * errno set to abort rendering.
+ */
+typedef int (*tapewave_sink_t) (void *context, const uint8_t *data, size_t length);
+
+/*
+ * State for rendering one tape.
+ *
+ * The encoder holds no references to shared mutable state, so any number of
+ * encoders may be used concurrently, each from its own thread. The fields
+ * should be treated as private.
+ */
+typedef struct tapewave_encoder_s {
+    tapewave_sink_t sink;
+    void *sink_context;
+    bool output_failed;
+    int output_errno;
+
+    /* Data waiting to be passed to the sink. */
+    uint8_t *output_buffer;
+    uint32_t output_buffer_size;
+    uint32_t output_buffer_used;
+
+    /* Memory owned by the encoder, reused between tapes. */
+    uint8_t *storage;
+    uint32_t storage_size;
+} tapewave_encoder_t;
+
+
+/*
+ * Set the options to their defaults.
+ */
+void tapewave_options_init (tapewave_options_t *options);
+
+/*
+ * Initialise an encoder. The encoder's buffer is kept between calls
+ * to tapewave_encode, so an encoder may be reused for many tapes.
+ */
+void tapewave_encoder_init (tapewave_encoder_t *encoder);
+
+/*
+ * Free the memory held by an encoder.
+ */
+void tapewave_encoder_free (tapewave_encoder_t *encoder);
+
+/*
+ * Calculate the size in bytes of the wave file for a program of the given length.
+ * Returns 0 if the options are not valid.
+ */
+uint32_t tapewave_wav_size (const tapewave_options_t *options, uint16_t program_length);
+
+/*
+ * Render a program as a complete wave file, written to the file descriptor 'fd'.
+ *
+ * If 'stream' is false, the file is rendered into a single buffer and
+ * written with one call to write. If 'stream' is true, a smaller buffer
+ * is used, and written to 'fd' each time it fills.
+ *
+ * The file descriptor is not closed. Returns 0 on success, or -1 with
+ * errno set on failure, including EINVAL for unsupported options.
+ */
+int tapewave_encode (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                     const uint8_t *program, uint16_t program_length, int fd, bool stream);
+
+/*
+ * Render a program as a complete wave file, passed to 'sink' in spans
+ * of up to TAPEWAVE_STREAM_BUFFER_SIZE bytes.
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
+ */
+int tapewave_encode_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                             const uint8_t *program, uint16_t program_length,
+                             tapewave_sink_t sink, void *sink_context);
+
+/*
+ * Render a program as a complete wave file, into a caller-supplied buffer
+ * of at least tapewave_wav_size (options, program_length) bytes. No encoder
+ * is needed. If options->threads is more than one, the program is split into
+ * slices that are rendered concurrently, each into its own region of the buffer.
+ *
+ * Returns 0 on success, or -1 with errno set to ENOSPC if the buffer is too small.
+ */
+int tapewave_encode_to_buffer (const tapewave_options_t *options, const char *name,
+                               const uint8_t *program, uint16_t program_length,
+                               uint8_t *buffer, size_t buffer_size);
+/*
+ * Render a program as a complete wave file, directly into a shared memory-mapping
+ * of 'fd', which must be a regular file opened for reading and writing. The file
+ * is first truncated to the exact size of the wave file. This avoids copying the
+ * samples through an intermediate buffer. If the program cannot be laid out,
+ * such as a turbo program that is too large, the file is left untouched.
+ *
+ * The file descriptor is not closed. Returns 0 on success, or -1 with errno set on failure.
+ */
+int tapewave_encode_to_mmap (const tapewave_options_t *options, const char *name,
+                             const uint8_t *program, uint16_t program_length, int fd);
+
+/*
+ * Render a program as a FLAC file, losslessly compressing the same 8-bit
+ * samples as the wave file. Silent blocks are stored as constants, and the
+ * square waves are predicted so that only their edges cost more than one
+ * bit per sample. Passed to 'sink' in spans of up to TAPEWAVE_STREAM_BUFFER_SIZE
+ * bytes. The MD5 signature in the STREAMINFO block is left unset.
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
+ */
+int tapewave_encode_flac_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                                  const uint8_t *program, uint16_t program_length,
+                                  tapewave_sink_t sink, void *sink_context);
+
+/*
+ * Render a program as a FLAC file, written to the file descriptor 'fd' as it
+ * is compressed. The file descriptor is not closed. Returns 0 on success, or -1
+ * with errno set on failure.
+ */
+int tapewave_encode_flac (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                          const uint8_t *program, uint16_t program_length, int fd);
+
+/*
+ * Write a program as a TZX tape image for emulators, describing the signal
+ * rather than sampling it. Each block is a generalised data block (ID 0x19),
+ * with the leader as its pilot, and one symbol for each of the '0' and '1'
+ * bit waveforms. Silences are stored as pauses. The sample rate option has no
+ * effect. Passed to 'sink' in spans of up to TAPEWAVE_STREAM_BUFFER_SIZE bytes.
+ *
+ * Returns 0 on success, or -1 with errno set on failure.
+ */
+int tapewave_encode_tzx_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                                 const uint8_t *program, uint16_t program_length,
+                                 tapewave_sink_t sink, void *sink_context);
+
+/*
+ * Write a program as a TZX tape image, to the file descriptor 'fd'. The file
+ * descriptor is not closed. Returns 0 on success, or -1 with errno set on failure.
+ */
+int tapewave_encode_tzx (tapewave_encoder_t *encoder, const tapewave_options_t *options, const char *name,
+                         const uint8_t *program, uint16_t program_length, int fd);
+
+/*
+ * Render several programs, one after another, as a single wave file passed to
+ * 'sink' in spans of up to TAPEWAVE_STREAM_BUFFER_SIZE bytes. The length of the
+ * whole tape is known from the program lengths alone, so the header is written
+ * first, and the file is rendered in a single pass. Only one program's tape is
+ * laid out at a time.
+ *
+ * Returns 0 on success, or -1 with errno set on failure, including EFBIG if the
+ * tape is too long for a wave file.
+ */
+int tapewave_encode_list_to_sink (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                                  const tapewave_entry_t *entries, uint32_t entry_count,
+                                  tapewave_sink_t sink, void *sink_context);
+
+/*
+ * Render several programs as a single wave file, written to the file descriptor
+ * 'fd' as it is rendered. The file descriptor is not closed. Returns 0 on success,
+ * or -1 with errno set on failure.
+ */
+int tapewave_encode_list (tapewave_encoder_t *encoder, const tapewave_options_t *options,
+                          const tapewave_entry_t *entries, uint32_t entry_count, int fd);
+
+/*
+ * Update an existing wave file, previously rendered from 'old_program', so
+ * that it holds 'program' instead. Both programs must be the same length,
+ * and the name and options must match those used for the original render.
+ * Only the samples of the bytes that differ, and of the parity byte, are
+ * re-rendered and written in place with pwrite. The work done scales with
+ * the size of the edit, not the size of the program.
+ *
+ * Returns the number of program bytes that differed, or -1 with errno set on failure.
+ */
+int tapewave_patch (const tapewave_options_t *options, const char *name, const uint8_t *old_program,
+                    const uint8_t *program, uint16_t program_length, int fd);
+
+
+/* Opaque layout of a tape, for random access to its samples. */
+typedef struct tapewave_tape_s tapewave_tape_t;
+
+
+/*
+ * Create a tape for random access to its samples, without rendering it.
+ * The program is referenced rather than copied, so must remain valid
+ * until the tape is freed. Creating a tape reads the program once to
+ * calculate its parity byte. After that, each sample is found in constant
+ * time. Returns NULL with errno set on failure.
+ */
+tapewave_tape_t *tapewave_tape_create (const tapewave_options_t *options, const char *name,
+                                       const uint8_t *program, uint16_t program_length);
+
+/*
+ * Free a tape.
+ */
+void tapewave_tape_free (tapewave_tape_t *tape);
+
+/*
+ * Get the number of samples in a tape. This is the size of the wave
+ * file's data, excluding the header.
+ */
+uint64_t tapewave_tape_samples (const tapewave_tape_t *tape);
+
+/*
+ * Get the value of sample 'n', counting from the first sample after the wave
+ * file's header. Samples past the end of the tape are silent.
+ */
+uint8_t tapewave_sample_at (const tapewave_tape_t *tape, uint64_t n);
+
+/*
+ * Render 'count' samples starting from sample 'start' into 'buffer'. Only the
+ * requested range is rendered. Returns the number of samples rendered, which is
+ * less than 'count' if the range runs past the end of the tape.
+ */
+size_t tapewave_render_range (const tapewave_tape_t *tape, uint64_t start, size_t count, uint8_t *buffer);
+
+/* Part of a tape's layout: either a silent gap, or a block of bytes. */
+typedef struct tapewave_section_s {
+    uint64_t start;             /* First sample, counting from the end of the wave file's header */
+    uint64_t samples;
+    bool is_block;
+
+    /* Blocks only */
+    uint32_t speed;             /* Multiple of the standard 1200 baud: 1, or the speed-up of a turbo block */
+    uint8_t key_code;           /* 0x16 for the header block, 0x17 for the program block */
+    uint32_t data_length;       /* Bytes of data, not counting the key-code, parity, or dummy bytes */
+    uint64_t leader_samples;    /* The leader field */
+    uint64_t data_samples;      /* The key-code and data */
+    uint64_t trailer_samples;   /* The parity byte and two dummy bytes */
+} tapewave_section_t;
+
+/*
+ * Get the layout of the tape for a program of the given length, without
+ * reading or rendering the program. Every section's length is calculated in
+ * closed form from the program length and sample rate. Up to 'max_sections'
+ * sections are written to 'sections', which may be NULL if 'max_sections' is 0.
+ *
+ * Returns the number of sections in the tape, or -1 with errno set on failure.
+ */
+int tapewave_tape_layout (const tapewave_options_t *options, uint16_t program_length,
+                          tapewave_section_t *sections, uint32_t max_sections);
+
+/*
+ * Get the layout of a tape holding several programs, from their lengths alone.
+ * If 'starts' is not NULL, the first sample of each program's tape is written to
+ * it, as an index to seek to each program by. The names and programs are not read.
+ *
+ * Returns the total number of samples, or 0 with errno set on failure.
+ */
+uint64_t tapewave_list_layout (const tapewave_options_t *options, const tapewave_entry_t *entries,
+                               uint32_t entry_count, uint64_t *starts);
+
+/* A run of samples at a single level. The level is the sample value: 0xff, 0x00, or 0x80 for silence. */
+typedef struct tapewave_pulse_s {
+    uint32_t samples;
+    uint8_t level;
+} tapewave_pulse_t;
+
+/*
+ * Get a tape as a list of pulses, each a half-cycle of the signal or a gap of
+ * silence. This describes the whole tape without rendering it: a leader or a
+ * silent gap costs one entry per half-cycle rather than one byte per sample,
+ * so the list is far smaller than the samples at high sample rates. At low
+ * rates, where a half-cycle is only a few samples long, it can be larger.
+ *
+ * Returns a newly allocated array to be released with free (), with the number
+ * of pulses written to 'pulse_count', or NULL with errno set on failure.
+ */
+tapewave_pulse_t *tapewave_tape_pulses (const tapewave_tape_t *tape, size_t *pulse_count);
+
+/*
+ * Render a list of pulses as samples, with one memset per pulse.
+ * Returns the number of samples written to 'buffer'.
+ */
+size_t tapewave_render_pulses (const tapewave_pulse_t *pulses, size_t pulse_count, uint8_t *buffer);
+
+
+/* Result of decoding a program from a tape recording. */
+typedef enum tapewave_decode_result_e {
+    TAPEWAVE_DECODE_OK = 0,
+    TAPEWAVE_DECODE_END,                /* No further programs in the recording */
+    TAPEWAVE_DECODE_BAD_WAV,            /* Not an 8 or 16-bit PCM wave file */
+    TAPEWAVE_DECODE_TRUNCATED,          /* A block ended before all of its bytes were read */
+    TAPEWAVE_DECODE_NO_PROGRAM,         /* A header block was not followed by its program block */
+    TAPEWAVE_DECODE_HEADER_PARITY,      /* The header block failed its parity check */
+    TAPEWAVE_DECODE_PROGRAM_PARITY,     /* The program block failed its parity check */
+    TAPEWAVE_DECODE_NO_MEMORY
+} tapewave_decode_result_t;
+
+/* A program read back out of a tape recording. */
+typedef struct tapewave_program_s {
+    char name [17];         /* Name from the header block, with trailing spaces removed */
+    uint16_t length;        /* Program length from the header block */
+    uint8_t *data;          /* Program block, 'length' bytes */
+    double start_time;      /* Time in seconds from the start of the recording to the header leader */
+} tapewave_program_t;
+
+/* Opaque state for reading programs back out of a tape recording. */
+typedef struct tapewave_decoder_s tapewave_decoder_t;
+
+
+/*
+ * Open a decoder for a wave file held in memory. The memory must remain valid
+ * until the decoder is closed. Any sample rate is accepted, with 8 or 16-bit
+ * samples. Only the first channel is used.
+ *
+ * Returns NULL with 'result' set on failure.
+ */
+tapewave_decoder_t *tapewave_decoder_open (const uint8_t *wav, size_t wav_size, tapewave_decode_result_t *result);
+
+/*
+ * Close a decoder, freeing its memory.
+ */
+void tapewave_decoder_close (tapewave_decoder_t *decoder);
+
+/*
+ * Decode the next program in the recording, checking its key-codes and parity.
+ *
+ * Returns TAPEWAVE_DECODE_END once no further header blocks are found. On a
+ * parity error, the program is still filled in. In all cases, the program
+ * should be freed with tapewave_program_free.
+ */
+tapewave_decode_result_t tapewave_decoder_next (tapewave_decoder_t *decoder, tapewave_program_t *program);
+
+/*
+ * Free the data held by a decoded program.
+ */
+void tapewave_program_free (tapewave_program_t *program);
+
+/*
+ * Get a description of a decode result.
+ */
+const char *tapewave_decode_result_string (tapewave_decode_result_t result);
+
+#endif /* TAPEWAVE_H */
@@ -0,0 +1,202 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tapewave.h"
+#include "wave_table.h"
+#include "turbo.h"
+
+/*
+ * The turbo payload is an ordinary block, sent at a multiple of the standard
+ * baud rate. A '0' is one long cycle, and a '1' is two short cycles, so the
+ * loader times each full cycle of the input, from an edge to the next edge in
+ * the same direction, by counting iterations of a loop polling the cassette
+ * input: bit 7 of PPI port B.
+ *
+ * Every bit starts on a rising edge of the signal, but the leader is an even
+ * square wave, so the loader may have locked on to the falling edges. This is
+ * found from the start bit that ends the leader: measured between falling
+ * edges it is 3/4 of a bit long, rather than a whole bit, and the loader
+ * waits for one more edge to line up.
+ *
+ * The parity byte is only checked once the whole program is in, keeping the
+ * work between bytes short enough for the stop bits to cover at any speed.
+ */
+
+/* T-states per iteration of the loop waiting for an edge. */
+#define TURBO_LOOP_CYCLES       29
+
+/* T-states spent per cycle outside of the loop, handling the previous bit. */
+#define TURBO_OVERHEAD_CYCLES   85
+
+/* Short cycles in a row that are taken to be the leader. */
+#define TURBO_PILOT_CYCLES      64
+
+/* Offsets of fields in the loader body that are filled in for each payload. */
+#define BODY_SYNC_LOW           0x12
+#define BODY_SYNC_HIGH          0x16
+#define BODY_LENGTH             0x30
+#define BODY_SUM_LENGTH         0x48
+#define BODY_THRESHOLD          0x85
+
+/* Offsets of the absolute addresses within the body, which are relative to its start. */
+static const uint8_t turbo_body_relocations [] = {
+    0x06, 0x0e, 0x1d, 0x22, 0x25, 0x37, 0x3e,
+    0x41, 0x5c, 0x63, 0x68, 0x76, 0x7f
+};
+
+/* The loader, to be run from the address it is relocated to. */
+static const uint8_t turbo_body [TURBO_BODY_SIZE] = {
+    0xdb, 0xdd,                 /* 0000  start: in a, (0xdd)           */
+    0x4f,                       /* 0002  ld c, a                       */
+    0x1e, TURBO_PILOT_CYCLES,   /* 0003  pilot: ld e, PILOT_CYCLES     */
+    0xcd, 0x6f, 0x00,           /* 0005  pilot_loop: call cycle        */
+    0x30, 0xf9,                 /* 0008  jr nc, pilot                  */
+    0x1d,                       /* 000a  dec e                         */
+    0x20, 0xf8,                 /* 000b  jr nz, pilot_loop             */
+    0xcd, 0x6f, 0x00,           /* 000d  sync: call cycle              */
+    0x78,                       /* 0010  ld a, b                       */
+    0xfe, 0x00,                 /* 0011  cp SYNC_LOW                   */
+    0x38, 0xf8,                 /* 0013  jr c, sync                    */
+    0xfe, 0x00,                 /* 0015  cp SYNC_HIGH                  */
+    0x30, 0x08,                 /* 0017  jr nc, key                    */
+    0xdb, 0xdd,                 /* 0019  align: in a, (0xdd)           */
+    0xa9,                       /* 001b  xor c                         */
+    0xf2, 0x19, 0x00,           /* 001c  jp p, align                   */
+    0xa9,                       /* 001f  xor c                         */
+    0x4f,                       /* 0020  ld c, a                       */
+    0x21, 0x87, 0x00,           /* 0021  key: ld hl, key_byte          */
+    0xcd, 0x60, 0x00,           /* 0024  call read_bits                */
+    0x7e,                       /* 0027  ld a, (hl)                    */
+    0xfe, 0x17,                 /* 0028  cp 0x17                       */
+    0x20, 0xd7,                 /* 002a  jr nz, pilot                  */
+    0x21, 0x00, 0x98,           /* 002c  ld hl, 0x9800                 */
+    0x11, 0x00, 0x00,           /* 002f  ld de, program_length         */
+    0x7a,                       /* 0032  data: ld a, d                 */
+    0xb3,                       /* 0033  or e                          */
+    0x28, 0x07,                 /* 0034  jr z, parity                  */
+    0xcd, 0x5b, 0x00,           /* 0036  call read_byte                */
+    0x23,                       /* 0039  inc hl                        */
+    0x1b,                       /* 003a  dec de                        */
+    0x18, 0xf5,                 /* 003b  jr data                       */
+    0x21, 0x87, 0x00,           /* 003d  parity: ld hl, key_byte       */
+    0xcd, 0x5b, 0x00,           /* 0040  call read_byte                */
+    0x7e,                       /* 0043  ld a, (hl)                    */
+    0x21, 0x00, 0x98,           /* 0044  ld hl, 0x9800                 */
+    0x11, 0x00, 0x00,           /* 0047  ld de, program_length         */
+    0x47,                       /* 004a  sum: ld b, a                  */
+    0x7a,                       /* 004b  ld a, d                       */
+    0xb3,                       /* 004c  or e                          */
+    0x78,                       /* 004d  ld a, b                       */
+    0x28, 0x05,                 /* 004e  jr z, check                   */
+    0x86,                       /* 0050  add a, (hl)                   */
+    0x23,                       /* 0051  inc hl                        */
+    0x1b,                       /* 0052  dec de                        */
+    0x18, 0xf5,                 /* 0053  jr sum                        */
+    0xb7,                       /* 0055  check: or a                   */
+    0xfb,                       /* 0056  ei                            */
+    0xca, 0x00, 0x98,           /* 0057  jp z, 0x9800                  */
+    0xc9,                       /* 005a  ret                           */
+    0xcd, 0x6f, 0x00,           /* 005b  read_byte: call cycle         */
+    0x38, 0xfb,                 /* 005e  jr c, read_byte               */
+    0x36, 0x80,                 /* 0060  read_bits: ld (hl), 0x80      */
+    0xcd, 0x6f, 0x00,           /* 0062  bit: call cycle               */
+    0x30, 0x03,                 /* 0065  jr nc, zero                   */
+    0xcd, 0x6f, 0x00,           /* 0067  call cycle                    */
+    0xcb, 0x1e,                 /* 006a  zero: rr (hl)                 */
+    0x30, 0xf4,                 /* 006c  jr nc, bit                    */
+    0xc9,                       /* 006e  ret                           */
+    0x06, 0x00,                 /* 006f  cycle: ld b, 0                */
+    0x04,                       /* 0071  first_half: inc b             */
+    0xdb, 0xdd,                 /* 0072  in a, (0xdd)                  */
+    0xa9,                       /* 0074  xor c                         */
+    0xf2, 0x71, 0x00,           /* 0075  jp p, first_half              */
+    0xa9,                       /* 0078  xor c                         */
+    0x4f,                       /* 0079  ld c, a                       */
+    0x04,                       /* 007a  second_half: inc b            */
+    0xdb, 0xdd,                 /* 007b  in a, (0xdd)                  */
+    0xa9,                       /* 007d  xor c                         */
+    0xf2, 0x7a, 0x00,           /* 007e  jp p, second_half             */
+    0xa9,                       /* 0081  xor c                         */
+    0x4f,                       /* 0082  ld c, a                       */
+    0x78,                       /* 0083  ld a, b                       */
+    0xfe, 0x00,                 /* 0084  cp THRESHOLD                  */
+    0xc9,                       /* 0086  ret                           */
+    0x00,                       /* 0087  key_byte: db 0                */
+};
+
+_Static_assert (TURBO_LOAD_ADDRESS + TAPEWAVE_TURBO_MAX_PROGRAM_LENGTH + TURBO_BODY_SIZE <= TURBO_RAM_END,
+                "The largest turbo payload leaves no room for the loader");
+
+
+/*
+ * Get the loop count that separates cycles shorter and longer than 'eighths' eighths of a bit.
+ */
+static uint8_t turbo_count (uint32_t speed, uint32_t eighths)
+{
+    uint32_t cycles = (uint64_t) Z80_CLOCK_HZ * eighths / (BAUD_RATE * speed * 8);
+    uint32_t count = (cycles > TURBO_OVERHEAD_CYCLES) ?
+                     (cycles - TURBO_OVERHEAD_CYCLES + TURBO_LOOP_CYCLES / 2) / TURBO_LOOP_CYCLES : 0;
+
+    return (count < 1) ? 1 : (count > 255) ? 255 : count;
+}
+
+
+/*
+ * Write a 16-bit little-endian value.
+ */
+static void put_16 (uint8_t *buffer, uint16_t value)
+{
+    buffer [0] = value;
+    buffer [1] = value >> 8;
+}
+
+
+/*
+ * Write the machine-code loader for a turbo payload.
+ */
+size_t turbo_loader (uint8_t *buffer, uint16_t program_length, uint32_t speed)
+{
+    /* The payload overwrites the loaded copy of the loader, so it is first
+     * moved to just past the end of both. */
+    uint16_t body_address = TURBO_LOAD_ADDRESS + ((program_length > TURBO_LOADER_SIZE) ? program_length
+                                                                                         : TURBO_LOADER_SIZE);
+
+    buffer [0] = 0xf3;                                                  /* di              */
+    buffer [1] = 0x21;                                                  /* ld hl, source   */
+    put_16 (&buffer [2], TURBO_LOAD_ADDRESS + TURBO_RELOCATOR_SIZE);
+    buffer [4] = 0x11;                                                  /* ld de, body     */
+    put_16 (&buffer [5], body_address);
+    buffer [7] = 0x01;                                                  /* ld bc, size     */
+    put_16 (&buffer [8], TURBO_BODY_SIZE);
+    buffer [10] = 0xed;                                                 /* ldir            */
+    buffer [11] = 0xb0;
+    buffer [12] = 0xc3;                                                 /* jp body         */
+    put_16 (&buffer [13], body_address);
+
+    uint8_t *body = buffer + TURBO_RELOCATOR_SIZE;
+    memcpy (body, turbo_body, TURBO_BODY_SIZE);
+
+    for (size_t i = 0; i < sizeof (turbo_body_relocations); i++)
+    {
+        uint8_t *address = &body [turbo_body_relocations [i]];
+        put_16 (address, body_address + (address [0] | (address [1] << 8)));
+    }
+
+    /* A '0' is a whole bit long, and a '1' is two cycles of half a bit. Out of
+     * line, the start bit is 3/4 of a bit long. */
+    body [BODY_SYNC_LOW] = turbo_count (speed, 5);
+    body [BODY_SYNC_HIGH] = turbo_count (speed, 7);
+    body [BODY_THRESHOLD] = turbo_count (speed, 6);
+    put_16 (&body [BODY_LENGTH], program_length);
+    put_16 (&body [BODY_SUM_LENGTH], program_length);
+
+    return TURBO_LOADER_SIZE;
+}
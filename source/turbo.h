@@ -0,0 +1,37 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef TURBO_H
+#define TURBO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Clock of the SC-3000's Z80, which times the loader. */
+#define Z80_CLOCK_HZ            3579545
+
+/* BASIC loads programs to this address, and the turbo payload is loaded to the same place. */
+#define TURBO_LOAD_ADDRESS      0x9800
+
+/* The loader copies itself to just past the payload. Both must end below this address,
+ * leaving the top of RAM to BASIC's stack and work area. */
+#define TURBO_RAM_END           0xf000
+
+/* Size of the loader: a short routine to relocate it, and the loader itself. */
+#define TURBO_RELOCATOR_SIZE    15
+#define TURBO_BODY_SIZE         136
+#define TURBO_LOADER_SIZE       (TURBO_RELOCATOR_SIZE + TURBO_BODY_SIZE)
+
+
+/*
+ * Write the machine-code loader for a turbo payload of 'program_length' bytes,
+ * sent at 'speed' times the standard baud rate. Returns the number of bytes
+ * written, TURBO_LOADER_SIZE.
+ */
+size_t turbo_loader (uint8_t *buffer, uint16_t program_length, uint32_t speed);
+
+#endif /* TURBO_H */
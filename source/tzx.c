@@ -0,0 +1,169 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tape.h"
+#include "tzx.h"
+
+/*
+ * TZX timings are given in T-states of the 3.5 MHz ZX Spectrum clock, whatever
+ * the machine. A '0' is two pulses of a 1200 Hz cycle, and a '1' is four pulses
+ * of two 2400 Hz cycles. Rounding to whole T-states makes each bit 0.02% long.
+ * A turbo block divides the pulse lengths by its speed.
+ */
+#define TZX_CLOCK_HZ            3500000
+#define TZX_BIT_0_PULSE         (TZX_CLOCK_HZ / (BAUD_RATE * 2))
+#define TZX_BIT_1_PULSE         (TZX_CLOCK_HZ / (BAUD_RATE * 4))
+
+/* Generalised data blocks here use symbols of up to four pulses: the leader
+ * is a run of '1' symbols, and the data uses one symbol for each bit value. */
+#define TZX_SYMBOL_PULSES       4
+#define TZX_SYMBOL_SIZE         (1 + 2 * TZX_SYMBOL_PULSES)
+
+/* Block ID and length field, then the fixed fields of a generalised data block. */
+#define TZX_BLOCK_HEADER_SIZE   (1 + 4 + 2 + 4 + 1 + 1 + 4 + 1 + 1)
+
+/* Pilot symbol table, and a single run-length entry of the leader. */
+#define TZX_PILOT_SIZE          (TZX_SYMBOL_SIZE + 3)
+
+
+/*
+ * Write a 16-bit little-endian value.
+ */
+static uint8_t *put_16 (uint8_t *buffer, uint16_t value)
+{
+    buffer [0] = value;
+    buffer [1] = value >> 8;
+
+    return buffer + 2;
+}
+
+
+/*
+ * Write a 32-bit little-endian value.
+ */
+static uint8_t *put_32 (uint8_t *buffer, uint32_t value)
+{
+    buffer = put_16 (buffer, value);
+
+    return put_16 (buffer, value >> 16);
+}
+
+
+/*
+ * Write a symbol definition. Each symbol starts with an edge, so that every
+ * bit starts high, as the block's first edge follows a low level.
+ */
+static uint8_t *put_symbol (uint8_t *buffer, uint16_t pulse_length, uint32_t pulse_count)
+{
+    *buffer++ = 0x00;
+
+    for (uint32_t i = 0; i < TZX_SYMBOL_PULSES; i++)
+    {
+        buffer = put_16 (buffer, (i < pulse_count) ? pulse_length : 0);
+    }
+
+    return buffer;
+}
+
+
+/*
+ * Write the TZX file header and archive info block.
+ */
+size_t tzx_preamble (uint8_t *buffer, const uint8_t *name)
+{
+    uint8_t *start = buffer;
+
+    memcpy (buffer, "ZXTape!\x1a", 8);
+    buffer [8] = 1;     /* Version 1.20 */
+    buffer [9] = 20;
+    buffer += 10;
+
+    /* The file-name is padded with spaces, which are left out of the title */
+    uint8_t name_length = 16;
+    while (name_length > 0 && name [name_length - 1] == ' ')
+    {
+        name_length--;
+    }
+
+    *buffer++ = 0x32;
+    buffer = put_16 (buffer, 1 + 2 + name_length);
+    *buffer++ = 1;      /* One text string */
+    *buffer++ = 0x00;   /* Title */
+    *buffer++ = name_length;
+    memcpy (buffer, name, name_length);
+    buffer += name_length;
+
+    return buffer - start;
+}
+
+
+/*
+ * Write a pause block.
+ */
+void tzx_pause (uint8_t *buffer, uint32_t pause_ms)
+{
+    buffer [0] = 0x20;
+    put_16 (buffer + 1, pause_ms);
+}
+
+
+/*
+ * Get the size of the generalised data block holding a tape block.
+ */
+size_t tzx_block_size (const tape_block_t *block)
+{
+    uint32_t data_bits = tape_block_bits (block) - block->leader_bits;
+
+    return TZX_BLOCK_HEADER_SIZE + TZX_PILOT_SIZE + 2 * TZX_SYMBOL_SIZE + (data_bits + 7) / 8;
+}
+
+
+/*
+ * Write a tape block as a generalised data block.
+ */
+void tzx_block (uint8_t *buffer, const tape_block_t *block, uint32_t pause_ms)
+{
+    uint32_t block_bits = tape_block_bits (block);
+    uint32_t data_bits = block_bits - block->leader_bits;
+
+    /* The length field counts everything after itself */
+    *buffer++ = 0x19;
+    buffer = put_32 (buffer, tzx_block_size (block) - 5);
+    buffer = put_16 (buffer, pause_ms);
+
+    /* Pilot: one run of the leader's '1' bits, from a single symbol */
+    buffer = put_32 (buffer, 1);
+    *buffer++ = TZX_SYMBOL_PULSES;
+    *buffer++ = 1;
+
+    /* Data: one symbol per bit */
+    buffer = put_32 (buffer, data_bits);
+    *buffer++ = TZX_SYMBOL_PULSES;
+    *buffer++ = 2;
+
+    buffer = put_symbol (buffer, TZX_BIT_1_PULSE / block->speed, 4);
+    *buffer++ = 0;
+    buffer = put_16 (buffer, block->leader_bits);
+
+    buffer = put_symbol (buffer, TZX_BIT_0_PULSE / block->speed, 2);
+    buffer = put_symbol (buffer, TZX_BIT_1_PULSE / block->speed, 4);
+
+    /* The data stream packs one bit per symbol, most significant bit first */
+    memset (buffer, 0, (data_bits + 7) / 8);
+    for (uint32_t i = 0; i < data_bits; i++)
+    {
+        if (tape_block_bit (block, block->leader_bits + i))
+        {
+            buffer [i / 8] |= 0x80 >> (i % 8);
+        }
+    }
+}
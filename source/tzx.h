@@ -0,0 +1,45 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef TZX_H
+#define TZX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tape.h"
+
+/* File header, and an archive info block holding the tape name. */
+#define TZX_PREAMBLE_MAX_SIZE   (10 + 1 + 2 + 1 + 2 + 16)
+
+/* A pause block. */
+#define TZX_PAUSE_SIZE          3
+
+
+/*
+ * Write the TZX file header, and an archive info block giving the
+ * file-name from the tape's header block as the title.
+ * Returns the number of bytes written, at most TZX_PREAMBLE_MAX_SIZE.
+ */
+size_t tzx_preamble (uint8_t *buffer, const uint8_t *name);
+
+/*
+ * Write a block of silence, as a pause block of 'pause_ms' milliseconds.
+ */
+void tzx_pause (uint8_t *buffer, uint32_t pause_ms);
+
+/*
+ * Get the size of the generalised data block holding a tape block.
+ */
+size_t tzx_block_size (const tape_block_t *block);
+
+/*
+ * Write a tape block as a generalised data block, followed by 'pause_ms' milliseconds of silence.
+ */
+void tzx_block (uint8_t *buffer, const tape_block_t *block, uint32_t pause_ms);
+
+#endif /* TZX_H */
@@ -0,0 +1,161 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wave_table.h"
+
+/* Per-byte waveforms are skipped for sample rates where they would need more memory than this. */
+#define BYTE_WAVE_MAX_SIZE  (4 << 20)
+
+/* Tables rendered so far, one per sample rate. */
+static wave_table_t *wave_tables = NULL;
+static pthread_mutex_t wave_tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Greatest common divisor.
+ */
+static uint32_t gcd (uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+
+/*
+ * Render bit 'bit_index' of a run of bits into 'wave'.
+ */
+static void render_bit (uint32_t sample_rate, uint32_t bit_index, bool bit, uint8_t *wave)
+{
+    uint64_t start = wave_bit_start (sample_rate, bit_index);
+    uint64_t end = wave_bit_start (sample_rate, bit_index + 1);
+
+    for (uint64_t n = start; n < end; n++)
+    {
+        /* Position within the bit, scaled so that the bit spans [0, sample_rate) */
+        uint64_t x = n * BAUD_RATE - (uint64_t) bit_index * sample_rate;
+
+        *wave++ = wave_level (sample_rate, x, bit);
+    }
+}
+
+
+/*
+ * Render the waveforms for a sample rate.
+ */
+static wave_table_t *wave_table_create (uint32_t sample_rate)
+{
+    wave_table_t *table = calloc (1, sizeof (wave_table_t));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t divisor = gcd (sample_rate, BAUD_RATE);
+    table->sample_rate = sample_rate;
+    table->phases = BAUD_RATE / divisor;
+    table->period_samples = sample_rate / divisor;
+
+    /* Bits and bytes are at most one sample longer than their average length */
+    table->bit_stride = sample_rate / BAUD_RATE + 1;
+    table->byte_stride = sample_rate * BYTE_BITS / BAUD_RATE + 1;
+
+    table->bit_length = calloc (table->phases, sizeof (uint16_t));
+    table->bit_wave = calloc ((size_t) table->phases * 2, table->bit_stride);
+    table->byte_length = calloc (table->phases, sizeof (uint16_t));
+    if (table->bit_length == NULL || table->bit_wave == NULL || table->byte_length == NULL)
+    {
+        free (table->bit_length);
+        free (table->bit_wave);
+        free (table->byte_length);
+        free (table);
+        return NULL;
+    }
+
+    for (uint32_t phase = 0; phase < table->phases; phase++)
+    {
+        table->bit_length [phase] = wave_bit_start (sample_rate, phase + 1) - wave_bit_start (sample_rate, phase);
+        table->byte_length [phase] = wave_bit_start (sample_rate, phase + BYTE_BITS) - wave_bit_start (sample_rate, phase);
+
+        render_bit (sample_rate, phase, 0, table->bit_wave + (phase * 2 + 0) * table->bit_stride);
+        render_bit (sample_rate, phase, 1, table->bit_wave + (phase * 2 + 1) * table->bit_stride);
+    }
+
+    /* Render each byte from the bit waveforms, if it fits in a reasonable amount of memory */
+    if ((size_t) table->phases * 256 * table->byte_stride <= BYTE_WAVE_MAX_SIZE)
+    {
+        table->byte_wave = malloc ((size_t) table->phases * 256 * table->byte_stride);
+    }
+
+    if (table->byte_wave != NULL)
+    {
+        for (uint32_t phase = 0; phase < table->phases; phase++)
+        {
+            for (int byte = 0; byte < 256; byte++)
+            {
+                /* Start bit, data bits, and two stop bits */
+                uint16_t frame = 0x600 | (byte << 1);
+                uint8_t *wave = table->byte_wave + (phase * 256 + byte) * table->byte_stride;
+
+                for (uint32_t i = 0; i < BYTE_BITS; i++)
+                {
+                    uint32_t bit_phase = (phase + i) % table->phases;
+                    memcpy (wave, wave_bit (table, bit_phase, (frame >> i) & 1), table->bit_length [bit_phase]);
+                    wave += table->bit_length [bit_phase];
+                }
+            }
+        }
+    }
+
+    return table;
+}
+
+
+/*
+ * Get the waveform table for a sample rate, rendering it on first use.
+ */
+const wave_table_t *wave_table_get (uint32_t sample_rate)
+{
+    wave_table_t *table;
+
+    pthread_mutex_lock (&wave_tables_mutex);
+
+    for (table = wave_tables; table != NULL; table = table->next)
+    {
+        if (table->sample_rate == sample_rate)
+        {
+            break;
+        }
+    }
+
+    if (table == NULL)
+    {
+        table = wave_table_create (sample_rate);
+        if (table != NULL)
+        {
+            table->next = wave_tables;
+            wave_tables = table;
+        }
+    }
+
+    pthread_mutex_unlock (&wave_tables_mutex);
+
+    return table;
+}
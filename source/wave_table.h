@@ -0,0 +1,100 @@
+/*
+ * SC-TapeWave
+ * A tool to generate SC-3000 tape audio.
+ *
+ * JoppyFurr 2024
+ */
+
+#ifndef WAVE_TABLE_H
+#define WAVE_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Note that samples in 8-bit wave files are unsigned. */
+#define WAVE_HIGH       0xff
+#define WAVE_LOW        0x00
+#define WAVE_SILENT     0x80
+
+/* Tape bits are sent at 1200 baud. */
+#define BAUD_RATE       1200
+
+/* Samples per bit at the default sample rate. */
+#define BIT_SAMPLES     8
+
+/* Bits per byte, including the start bit and two stop bits. */
+#define BYTE_BITS       11
+
+/*
+ * Pre-rendered waveforms for one sample rate.
+ *
+ * Bit 'k' of a run of bits starts at sample ceil (k * sample_rate / 1200), counting
+ * from the start of the run, so that bit boundaries never drift from their exact
+ * position. When the sample rate is not a multiple of 1200, bits differ in length
+ * and alignment, but the pattern repeats every 'phases' bits. A waveform is
+ * rendered for each phase.
+ */
+typedef struct wave_table_s {
+    uint32_t sample_rate;
+    uint32_t phases;            /* Number of bits before the alignment pattern repeats */
+    uint32_t period_samples;    /* Number of samples in 'phases' bits */
+
+    /* Waveform for each phase of '0' and '1' bits, indexed by [phase] [bit] */
+    uint32_t bit_stride;
+    uint16_t *bit_length;
+    uint8_t *bit_wave;
+
+    /* Waveform for each phase of each byte value, including the start and stop bits,
+     * indexed by [phase] [byte]. Left as NULL if the table would be too large. */
+    uint32_t byte_stride;
+    uint16_t *byte_length;
+    uint8_t *byte_wave;
+
+    struct wave_table_s *next;
+} wave_table_t;
+
+
+/*
+ * Get the waveform table for a sample rate, rendering it on first use.
+ * Tables are shared between threads, and are never modified once returned.
+ * Returns NULL if out of memory.
+ */
+const wave_table_t *wave_table_get (uint32_t sample_rate);
+
+/*
+ * Get the sample, within a run of bits, at which bit 'bit' starts.
+ */
+static inline uint64_t wave_bit_start (uint32_t sample_rate, uint64_t bit)
+{
+    return (bit * sample_rate + BAUD_RATE - 1) / BAUD_RATE;
+}
+
+/*
+ * Get the level of the signal at position 'x' within a bit, where the bit spans
+ * [0, sample_rate). A '0' is one cycle at 1200 Hz, and a '1' is two cycles at
+ * 2400 Hz, each cycle starting high.
+ */
+static inline uint8_t wave_level (uint32_t sample_rate, uint64_t x, bool bit)
+{
+    bool high = bit ? (((x * 4 / sample_rate) & 1) == 0) : (x * 2 < sample_rate);
+
+    return high ? WAVE_HIGH : WAVE_LOW;
+}
+
+/*
+ * Get a pointer to the waveform of a bit at a given phase.
+ */
+static inline const uint8_t *wave_bit (const wave_table_t *table, uint32_t phase, bool bit)
+{
+    return table->bit_wave + (phase * 2 + bit) * table->bit_stride;
+}
+
+/*
+ * Get a pointer to the waveform of a byte at a given phase.
+ */
+static inline const uint8_t *wave_byte (const wave_table_t *table, uint32_t phase, uint8_t byte)
+{
+    return table->byte_wave + (phase * 256 + byte) * table->byte_stride;
+}
+
+#endif /* WAVE_TABLE_H */